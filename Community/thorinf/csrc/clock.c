@@ -0,0 +1,276 @@
+#include "clock.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "midi_parser.h"
+#include "pulse.h"
+
+volatile ClockTable clockTable;
+volatile ClockPll clockPll;
+
+const uint8_t clock_learn_divisions[CLOCK_LEARN_DIVISIONS] PROGMEM = {1, 3, 4, 6, 8, 12, 16, 24, 32, 48, 96, 192};
+
+// Sub-ticks each rate counts, bit n for sub-tick n
+static const uint8_t clock_rate_subticks[NUM_CLOCK_RATES] PROGMEM = {0x00, 0x01, 0x05, 0x0F};
+
+void clock_compile(const MIDIMapEntry *map) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t previous = clockTable.gates;
+
+        clockTable.gates = 0;
+        clockTable.directGates = 0;
+        clockTable.resetGates = 0;
+        for (uint8_t sub = 0; sub < CLOCK_SUBTICKS; sub++) {
+            clockTable.subGates[sub] = 0;
+        }
+
+        for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+            const MIDIMapEntry *entry = &map[gate];
+            uint8_t division = entry->gateValue ? entry->gateValue : 1;
+            uint8_t mask = 1 << gate;
+
+            if (entry->mapType != MIDIMAP_CLOCK) {
+                clockTable.count[gate] = 0;
+                continue;
+            }
+            if (!(previous & mask) || clockTable.division[gate] != division) {
+                clockTable.count[gate] = 0;  // Unchanged dividers keep their phase across a map change
+            }
+
+            clockTable.gates |= mask;
+            if (entry->cvValue1) clockTable.resetGates |= mask;
+            clockTable.division[gate] = division;
+            clockTable.offset[gate] = entry->cvCommand1 % division;
+
+            if (entry->cvCommand2 == CLOCK_RATE_DIRECT || entry->cvCommand2 >= NUM_CLOCK_RATES) {
+                clockTable.directGates |= mask;
+            } else {
+                uint8_t subticks = pgm_read_byte(&clock_rate_subticks[entry->cvCommand2]);
+                for (uint8_t sub = 0; sub < CLOCK_SUBTICKS; sub++, subticks >>= 1) {
+                    if (subticks & 1) clockTable.subGates[sub] |= mask;
+                }
+            }
+        }
+    }
+}
+
+// Advances the counters of the given gates and returns those that fire.
+static uint8_t clock_count(uint8_t gates) {
+    uint8_t fired = 0;
+
+    for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+        uint8_t count = clockTable.count[gate];
+
+        if (!(gates & (1 << gate))) continue;
+        if (count == clockTable.offset[gate]) fired |= 1 << gate;
+        if (++count >= clockTable.division[gate]) count = 0;
+        clockTable.count[gate] = count;
+    }
+    return fired;
+}
+
+// Pulse length for clocks spaced period / ratio apart, in Timer1 counts.
+static uint16_t clock_pulse_length(uint8_t ratio) {
+    uint16_t length = PULSE_MS(CLOCK_TRIGGER_MS);
+
+    if (clockPll.intervalCount >= 3) {
+        uint16_t half = (uint16_t)(clockPll.period >> 9) / ratio;
+        if (half < length) length = half;
+    }
+    return length;
+}
+
+static void clock_arm(uint32_t when) {
+    clockPll.when = when;
+    OCR1B = (uint16_t)(when >> 8);
+    TIFR = (1 << OCF1B);
+    TIMSK |= (1 << OCIE1B);
+}
+
+static void clock_disarm(void) { TIMSK &= ~(1 << OCIE1B); }
+
+// Emits the sub-tick due at clockPll.when and arms the next one.
+static void clock_subtick(void) {
+    uint8_t sub = clockPll.sub;
+    uint8_t fired;
+
+    if (sub == 0) {
+        if ((int8_t)(clockPll.emitted - clockPll.received) > 0) {
+            clockPll.stalled = 1;  // A full clock ahead of the input, wait for it
+            clock_disarm();
+            return;
+        }
+        clockPll.base = clockPll.when;
+        clockPll.next = clockPll.base + clockPll.period;
+        clockPll.emitted++;
+    }
+
+    fired = clock_count(clockTable.subGates[sub]);
+    if (fired) {
+        uint8_t ratio = 1;
+        if (fired & clockTable.subGates[1]) ratio = 4;  // 96ppqn gates tick on every sub-tick
+        else if (fired & clockTable.subGates[2]) ratio = 2;
+        pulse_trigger(fired, clock_pulse_length(ratio));
+    }
+
+    if (clockPll.intervalCount < 3) {
+        clockPll.stalled = 1;  // No tempo yet, received clocks drive the output
+        clock_disarm();
+        return;
+    }
+
+    if (++sub == CLOCK_SUBTICKS) {
+        sub = 0;
+        clock_arm(clockPll.next);
+    } else {
+        clock_arm(clockPll.base + (clockPll.period >> 2) * sub);
+    }
+    clockPll.sub = sub;
+
+    if ((int16_t)((uint16_t)(clockPll.when >> 8) - TCNT1) <= 0) {
+        clock_disarm();
+        clock_subtick();  // Already due, the compare would not fire until the wrap
+    }
+}
+
+static uint16_t clock_median(uint16_t a, uint16_t b, uint16_t c) {
+    if (a > b) {
+        uint16_t t = a;
+        a = b;
+        b = t;
+    }
+    if (b > c) b = c;
+    return a > b ? a : b;
+}
+
+static void clock_track(uint16_t stamp) {
+    uint32_t now = (uint32_t)stamp << 8;
+    int8_t lead;
+
+    // Tempo
+    if (!clockPll.fresh) {
+        uint16_t interval = stamp - clockPll.lastStamp;
+        uint32_t median;
+
+        clockPll.intervals[2] = clockPll.intervals[1];
+        clockPll.intervals[1] = clockPll.intervals[0];
+        clockPll.intervals[0] = interval;
+        if (clockPll.intervalCount < 3) clockPll.intervalCount++;
+
+        median = (uint32_t)clock_median(clockPll.intervals[0], clockPll.intervals[1], clockPll.intervals[2]) << 8;
+        if (clockPll.intervalCount < 3 || median > clockPll.period + (clockPll.period >> 2) ||
+            median < clockPll.period - (clockPll.period >> 2)) {
+            clockPll.period = median;  // First lock or a tempo jump, snap to it
+        } else {
+            clockPll.period += (int32_t)(median - clockPll.period) >> CLOCK_PLL_FREQUENCY_SHIFT;
+        }
+    }
+    clockPll.lastStamp = stamp;
+    clockPll.fresh = 0;
+    clockPll.received++;
+
+    // Phase
+    lead = (int8_t)(clockPll.emitted - clockPll.received);
+
+    if (lead == 0 && clockPll.intervalCount >= 3) {
+        // The output clock for this input is out, correct the next one
+        int16_t error = (int16_t)(stamp - (uint16_t)(clockPll.base >> 8));
+
+        clockPll.phaseError = error;
+        clockPll.next = clockPll.base + clockPll.period + ((int32_t)error << (8 - CLOCK_PLL_PHASE_SHIFT));
+        if (clockPll.sub == 0) {
+            clockPll.stalled = 0;
+            clock_arm(clockPll.next);
+        }
+    } else if (lead == -1 && !clockPll.stalled && clockPll.sub == 0) {
+        // Input ahead of the planned output, pull it in
+        int16_t error = (int16_t)(stamp - (uint16_t)(clockPll.when >> 8));
+
+        clockPll.phaseError = error;
+        clock_arm(clockPll.when + ((int32_t)error << (8 - CLOCK_PLL_PHASE_SHIFT)));
+    } else {
+        // Stalled, unlocked or a clock behind, restart the output from this input
+        clockPll.phaseError = 0;
+        clockPll.emitted = clockPll.received - 1;
+        clockPll.sub = 0;
+        clockPll.stalled = 0;
+        clockPll.when = now;
+        clock_disarm();
+        clock_subtick();
+        return;
+    }
+
+    uint16_t magnitude = clockPll.phaseError < 0 ? -clockPll.phaseError : clockPll.phaseError;
+    if (magnitude > clockPll.phaseErrorMax) clockPll.phaseErrorMax = magnitude;
+
+    if ((int16_t)((uint16_t)(clockPll.when >> 8) - TCNT1) <= 0 && (TIMSK & (1 << OCIE1B))) {
+        clock_disarm();
+        clock_subtick();
+    }
+}
+
+static void clock_restart(void) {
+    clockPll.received = 0;
+    clockPll.emitted = 0;
+    clockPll.sub = 0;
+    clockPll.stalled = 1;
+    clockPll.fresh = 1;
+    clockPll.phaseErrorMax = 0;
+    clock_disarm();
+}
+
+void clock_realtime(uint8_t status) {
+    uint16_t stamp = TCNT1;
+    uint8_t fired;
+
+    switch (status) {
+        case MIDI_CLOCK:
+            if (!clockTable.running) return;
+
+            fired = clock_count(clockTable.directGates);
+            if (fired) pulse_trigger(fired, clock_pulse_length(1));
+            clock_track(stamp);
+            break;
+
+        case MIDI_START:
+            for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+                if (clockTable.resetGates & (1 << gate)) clockTable.count[gate] = 0;
+            }
+            clock_restart();
+            clockTable.running = 1;
+            break;
+
+        case MIDI_CONTINUE:
+            clock_restart();
+            clockTable.running = 1;
+            break;
+
+        case MIDI_STOP:
+            clockTable.running = 0;
+            clock_disarm();
+            break;
+    }
+}
+
+void clock_seek(uint16_t position) {
+    for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+        uint8_t mask = 1 << gate;
+        uint8_t division = clockTable.division[gate];
+        uint8_t perSixteenth = 6;
+        uint8_t count;
+
+        if (!(clockTable.resetGates & mask)) continue;
+
+        if (clockTable.subGates[1] & mask) perSixteenth = 24;
+        else if (clockTable.subGates[2] & mask) perSixteenth = 12;
+
+        // (position * perSixteenth) % division without leaving 16 bits
+        count = ((position % division) * (perSixteenth % division)) % division;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { clockTable.count[gate] = count; }
+    }
+}
+
+ISR(TIMER1_COMPB_vect) { clock_subtick(); }
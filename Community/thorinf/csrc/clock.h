@@ -0,0 +1,90 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <avr/io.h>
+
+#include "hardware_config.h"
+#include "midimap.h"
+
+// Clock divider gates, run from the USART ISR on real-time bytes. A MIDIMAP_CLOCK entry
+// reads {MIDIMAP_CLOCK, MIDI_CLOCK, division, offset, resetOnStart, rate, 0}: the gate
+// pulses on every division-th clock of its rate, offset clocks late, and Start restarts
+// the count when resetOnStart is set. Clocks are only counted between Start/Continue
+// and Stop. Pulses are CLOCK_TRIGGER_MS long, or half the clock period when that is
+// shorter, unless the gate has its own trigger length.
+//
+// CLOCK_RATE_DIRECT counts the 0xF8 bytes themselves. The other rates count the
+// output of a tempo tracking PLL, which runs at 96ppqn and places its clocks from the
+// estimated period instead of copying the arrival time of each byte.
+//
+// The fast path is a fixed loop over eight counters plus one pulse engine call,
+// ~150 cycles (~10 us) per clock whatever the map holds; the PLL update adds ~200.
+#define CLOCK_TRIGGER_MS 5
+#define CLOCK_LEARN_DIVISIONS 12
+
+// Rates, in the rate field of the map entry
+#define CLOCK_RATE_DIRECT 0  // 24ppqn as received
+#define CLOCK_RATE_24 1      // 24ppqn, jitter filtered
+#define CLOCK_RATE_48 2      // 48ppqn
+#define CLOCK_RATE_96 3      // 96ppqn
+#define NUM_CLOCK_RATES 4
+
+#define CLOCK_SUBTICKS 4  // PLL clocks per received clock
+
+typedef struct {
+    uint8_t gates;       // Gates in clock mode
+    uint8_t directGates; // Of those, counting received clocks
+    uint8_t resetGates;  // Of those, restarted by Start
+    uint8_t running;
+    uint8_t subGates[CLOCK_SUBTICKS];  // Gates counting each PLL sub-tick
+    uint8_t division[NUM_GATES];
+    uint8_t offset[NUM_GATES];
+    uint8_t count[NUM_GATES];
+} ClockTable;
+
+// Tempo tracker. Times are Timer1 counts (16 us) in Q8 so the sub-tick spacing keeps
+// its fraction. The period is the median of the last three intervals fed through a
+// first order loop, the phase of the output clocks is pulled towards the received
+// ones by a quarter of the error per clock. The output never runs more than one
+// clock ahead of the input, so it stops with the clock. Scripts/clock_pll.py runs the
+// same loop on the host, phaseError and phaseErrorMax are in the status snapshot.
+#define CLOCK_PLL_FREQUENCY_SHIFT 3  // Period moves 1/8 of the way per clock
+#define CLOCK_PLL_PHASE_SHIFT 2      // Phase moves 1/4 of the way per clock
+
+typedef struct {
+    uint16_t lastStamp;
+    uint16_t intervals[3];
+    uint8_t intervalCount;   // Locked once three intervals are in
+    uint8_t fresh;           // Next clock starts a new interval run
+    uint32_t period;         // Q8 counts per received clock
+    uint32_t base;           // Q8 time of the last output clock
+    uint32_t next;           // Q8 time planned for the next output clock
+    uint32_t when;           // Q8 time of the sub-tick armed on compare B
+    uint8_t sub;             // Sub-tick due at when, 0 starts a clock
+    uint8_t received;        // Clocks received since Start
+    uint8_t emitted;         // Output clocks since Start
+    uint8_t stalled;         // Waiting for a received clock before the next output
+    int16_t phaseError;      // Received minus output clock, counts, negative is early
+    uint16_t phaseErrorMax;  // Largest |phaseError| since Start
+} ClockPll;
+
+extern volatile ClockTable clockTable;
+extern volatile ClockPll clockPll;
+
+// Division learnt from the note number, by pitch class from C:
+// 24ppqn, 32nd, 16th triplet, 16th, 8th triplet, 8th, quarter triplet, quarter,
+// half triplet, half, bar, two bars.
+extern const uint8_t clock_learn_divisions[CLOCK_LEARN_DIVISIONS];
+
+// Rebuilds the clock gates from the map. Gates that were already dividing by the same
+// division keep counting, the others restart from zero.
+void clock_compile(const MIDIMapEntry *map);
+
+// Real-time fast path, called from the USART ISR. Timer1 must be running.
+void clock_realtime(uint8_t status);
+
+// Moves the counts of the gates restarted by Start to a Song Position Pointer, in
+// sixteenths (six clocks) from the start of the song.
+void clock_seek(uint16_t position);
+
+#endif
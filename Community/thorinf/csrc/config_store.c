@@ -0,0 +1,176 @@
+#include "config_store.h"
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+ConfigStore configStore;
+
+static inline uint16_t config_address(uint8_t slot) { return EEPROM_CONFIG_ADDR + slot * CONFIG_SLOT_SIZE; }
+
+// Serial number order, so the sequence may wrap
+static inline uint8_t config_newer(uint16_t a, uint16_t b) { return (int16_t)(a - b) > 0; }
+
+static uint8_t config_find(uint8_t key) {
+    uint8_t found = CONFIG_EMPTY;
+
+    for (uint8_t slot = 0; slot < CONFIG_SLOTS; slot++) {
+        if (configStore.keys[slot] != key) continue;
+        if (found == CONFIG_EMPTY || config_newer(configStore.sequences[slot], configStore.sequences[found])) {
+            found = slot;
+        }
+    }
+    return found;
+}
+
+static uint8_t config_check(uint8_t slot, uint8_t *header) {
+    uint16_t address = config_address(slot);
+    uint16_t crc = 0xFFFF;
+    uint8_t length;
+
+    eeprom_read_block(header, (const void *)address, CONFIG_HEADER_SIZE);
+    if (header[0] != CONFIG_MAGIC || header[1] != CONFIG_LAYOUT_VERSION || header[3] > CONFIG_PAYLOAD_MAX) {
+        return 0;
+    }
+
+    length = CONFIG_HEADER_SIZE + header[3];
+    for (uint8_t i = 0; i < length; i++) {
+        crc = _crc_ccitt_update(crc, eeprom_read_byte((const uint8_t *)(address + i)));
+    }
+    return (eeprom_read_byte((const uint8_t *)(address + length)) == (uint8_t)crc) &&
+           (eeprom_read_byte((const uint8_t *)(address + length + 1)) == (uint8_t)(crc >> 8));
+}
+
+void config_scan(void) {
+    uint8_t header[CONFIG_HEADER_SIZE];
+
+    eeprom_queue_flush();
+    configStore.newest = CONFIG_EMPTY;
+    configStore.skipped = 0;
+
+    for (uint8_t slot = 0; slot < CONFIG_SLOTS; slot++) {
+        configStore.keys[slot] = CONFIG_EMPTY;
+
+        if (!config_check(slot, header)) {
+            if (header[0] != 0xFF) configStore.skipped++;  // Erased slots are simply free
+            continue;
+        }
+
+        configStore.keys[slot] = header[2];
+        configStore.sequences[slot] = header[4] | (header[5] << 8);
+        if (configStore.newest == CONFIG_EMPTY ||
+            config_newer(configStore.sequences[slot], configStore.sequences[configStore.newest])) {
+            configStore.newest = slot;
+        }
+    }
+}
+
+uint16_t config_payload(uint8_t key, uint8_t length) {
+    uint8_t slot = config_find(key);
+    uint16_t address;
+
+    if (slot == CONFIG_EMPTY) return 0;
+
+    address = config_address(slot);
+    eeprom_queue_flush();  // The record may still be on its way
+    if (eeprom_read_byte((const uint8_t *)(address + 3)) != length) return 0;
+    return address + CONFIG_HEADER_SIZE;
+}
+
+uint8_t config_length(uint8_t key) {
+    uint8_t slot = config_find(key);
+
+    if (slot == CONFIG_EMPTY) return 0;
+
+    eeprom_queue_flush();
+    return eeprom_read_byte((const uint8_t *)(config_address(slot) + 3));
+}
+
+uint8_t config_load(uint8_t key, void *dst, uint8_t length) {
+    uint16_t address = config_payload(key, length);
+
+    if (!address) return 0;
+
+    eeprom_read_block(dst, (const void *)address, length);
+    return 1;
+}
+
+// 1 when the newest record of key already holds these length bytes. Only called while
+// the queue is not writing, so config_payload() does not wait.
+static uint8_t config_unchanged(uint8_t key, const uint8_t *payload, uint8_t length) {
+    uint16_t address = config_payload(key, length);
+
+    if (!address) return 0;
+
+    for (uint8_t i = 0; i < length; i++) {
+        if (eeprom_read_byte((const uint8_t *)(address + i)) != payload[i]) return 0;
+    }
+    return 1;
+}
+
+// The first slot after the last write that is free or holds a record a newer one of
+// the same key has replaced.
+static uint8_t config_free_slot(void) {
+    uint8_t slot = configStore.newest;
+
+    for (uint8_t i = 0; i < CONFIG_SLOTS; i++) {
+        uint8_t key;
+
+        slot = (slot == CONFIG_EMPTY || slot + 1 >= CONFIG_SLOTS) ? 0 : slot + 1;
+        key = configStore.keys[slot];
+        if (key == CONFIG_EMPTY || config_find(key) != slot) return slot;
+    }
+    return CONFIG_EMPTY;
+}
+
+uint8_t config_commit(uint8_t key, uint8_t length) {
+    uint8_t *record = eepromQueue.data;
+    uint8_t slot = config_free_slot();
+    uint16_t sequence = 0;
+    uint16_t crc = 0xFFFF;
+    uint8_t size = CONFIG_HEADER_SIZE + length;
+
+    if (slot == CONFIG_EMPTY || length > CONFIG_PAYLOAD_MAX) {
+        eeprom_queue_release();
+        return 0;
+    }
+    if (config_unchanged(key, record + CONFIG_HEADER_SIZE, length)) {
+        eeprom_queue_release();
+        return 1;
+    }
+    if (configStore.newest != CONFIG_EMPTY) sequence = configStore.sequences[configStore.newest] + 1;
+
+    record[0] = CONFIG_MAGIC;
+    record[1] = CONFIG_LAYOUT_VERSION;
+    record[2] = key;
+    record[3] = length;
+    record[4] = (uint8_t)sequence;
+    record[5] = (uint8_t)(sequence >> 8);
+    for (uint8_t i = 0; i < size; i++) {
+        crc = _crc_ccitt_update(crc, record[i]);
+    }
+    record[size] = (uint8_t)crc;
+    record[size + 1] = (uint8_t)(crc >> 8);
+
+    eeprom_queue_start(config_address(slot), size + 2);
+
+    configStore.keys[slot] = key;
+    configStore.sequences[slot] = sequence;
+    configStore.newest = slot;
+    return 1;
+}
+
+uint8_t config_save(uint8_t key, const void *src, uint8_t length) {
+    const uint8_t *bytes = (const uint8_t *)src;
+    uint8_t *payload;
+
+    if (length > CONFIG_PAYLOAD_MAX || eeprom_queue_busy()) return 0;
+    if (config_unchanged(key, bytes, length)) return 1;
+
+    payload = config_claim();
+    if (!payload) return 0;
+
+    for (uint8_t i = 0; i < length; i++) {
+        payload[i] = bytes[i];
+    }
+    return config_commit(key, length);
+}
@@ -0,0 +1,88 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <avr/io.h>
+
+#include "eeprom_control.h"
+#include "hardware_config.h"
+
+// Settings kept as records in a ring of EEPROM slots. A save never overwrites the
+// newest copy of what it saves, so that copy survives a write cut short by power
+// loss, and each save moves on round the ring, spreading the wear over every slot.
+//
+// Record, one slot of CONFIG_SLOT_SIZE bytes:
+//   magic, layout version, key, length, sequence (2), payload, CRC-16 (2)
+// The CRC (CCITT, 0xFFFF start) covers everything before it. A slot only counts when
+// magic, version and CRC check out, so blank, torn or foreign bytes, such as the
+// stock firmware's layout, are passed over. The newest record of a key is the one
+// with the highest sequence, compared as serial numbers.
+//
+// config_scan() reads every slot once at boot, CONFIG_SLOTS * CONFIG_SLOT_SIZE bytes
+// (~0.1 ms) whatever the EEPROM holds. Loads and saves then go by the table it built.
+// There must be fewer keys than slots, or a save can find nowhere to go.
+#define CONFIG_MAGIC 0x54
+#define CONFIG_LAYOUT_VERSION 1  // Bump whenever a payload changes shape
+#define CONFIG_HEADER_SIZE 6
+#define CONFIG_SLOT_SIZE 64
+#define CONFIG_PAYLOAD_MAX (CONFIG_SLOT_SIZE - CONFIG_HEADER_SIZE - 2)
+#define CONFIG_SLOTS ((E2END + 1 - EEPROM_CONFIG_ADDR) / CONFIG_SLOT_SIZE)
+
+#if CONFIG_SLOTS < 2
+#error "EEPROM_CONFIG_ADDR leaves no room for two config slots"
+#endif
+
+#if CONFIG_SLOT_SIZE > EEPROM_QUEUE_SIZE
+#error "A config record must fit the EEPROM queue buffer"
+#endif
+
+#define CONFIG_EMPTY 0xFF  // Key of a slot without a valid record, or no slot found
+
+// Keys
+#define CONFIG_KEY_MAP 0       // The MIDI map loaded at boot
+#define CONFIG_KEY_SETTINGS 1  // Program Change channel and gate settings, see Settings in main.c
+#define CONFIG_KEY_PRESET 2     // User presets, one key each
+
+typedef struct {
+    uint8_t keys[CONFIG_SLOTS];
+    uint16_t sequences[CONFIG_SLOTS];
+    uint8_t newest;    // Slot written last, of any key
+    uint8_t skipped;   // Slots that held something other than a valid record at boot
+} ConfigStore;
+
+extern ConfigStore configStore;
+
+void config_scan(void);
+
+// EEPROM address of the payload of the newest record of key, 0 when there is none or
+// it is not length bytes long. Waits for a write in progress, check eeprom_queue_busy()
+// first where that must not happen.
+uint16_t config_payload(uint8_t key, uint8_t length);
+
+// Payload length of the newest record of key, 0 when there is none. Waits like
+// config_payload().
+uint8_t config_length(uint8_t key);
+
+// Copies the payload of the newest record of key into dst. Returns 0, leaving dst
+// alone, when there is none or it is not length bytes long.
+uint8_t config_load(uint8_t key, void *dst, uint8_t length);
+
+// Records are put together in the EEPROM queue buffer itself. config_claim() returns
+// where the payload goes, or 0 while the buffer is in use, and config_commit() adds
+// header and CRC around the length bytes placed there and starts the write. A commit
+// that finds no slot releases the buffer and returns 0.
+//
+// A payload the newest record of key already holds is not written again, no new
+// record, no wear and the buffer is free at once. Both calls return 1 then without
+// starting a write, so eeprom_queue_busy() tells whether anything is being written.
+// The compare reads the payload from EEPROM, ~0.1 ms for a map.
+static inline uint8_t *config_claim(void) {
+    uint8_t *record = eeprom_queue_claim();
+    return record ? record + CONFIG_HEADER_SIZE : 0;
+}
+
+uint8_t config_commit(uint8_t key, uint8_t length);
+
+// Compares, claims, copies and commits. Returns 0 when the EEPROM queue is in use.
+uint8_t config_save(uint8_t key, const void *src, uint8_t length);
+
+#endif
@@ -0,0 +1,186 @@
+#include "dispatch.h"
+
+#include <avr/pgmspace.h>
+#include <stddef.h>
+
+#include "clock.h"
+
+static const uint8_t dispatch_bit[8] PROGMEM = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+
+static inline uint8_t bit_test(const uint8_t *bits, uint8_t index) {
+    return bits[index >> 3] & pgm_read_byte(&dispatch_bit[index & 0x07]);
+}
+
+static inline void bit_set(uint8_t *bits, uint8_t index) { bits[index >> 3] |= pgm_read_byte(&dispatch_bit[index & 0x07]); }
+
+static inline uint16_t rule_key(uint8_t status, uint8_t data1) { return ((uint16_t)status << 8) | data1; }
+
+// Index of the first rule not ordered before (key, action)
+static uint8_t rule_position(const DispatchTable *table, uint16_t key, uint8_t action) {
+    uint8_t low = 0;
+    uint8_t high = table->numRules;
+
+    while (low < high) {
+        uint8_t mid = (low + high) >> 1;
+        const DispatchRule *rule = &table->rules[mid];
+        uint16_t ruleKey = rule_key(rule->status, rule->data1);
+
+        if (ruleKey < key || (ruleKey == key && rule->action < action)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// The list stays ordered by key then action, actions run in that order. A rule for
+// the same key and action takes the gate on instead.
+static void add_rule(DispatchTable *table, uint8_t status, uint8_t data1, uint8_t action, uint8_t gate) {
+    uint16_t key = rule_key(status, data1);
+    uint8_t i;
+
+    if (status < 0x80 || status >= 0xC0 || data1 > DISPATCH_ANY) return;
+
+    i = rule_position(table, key, action);
+    if (i < table->numRules) {
+        DispatchRule *rule = &table->rules[i];
+        if (rule_key(rule->status, rule->data1) == key && rule->action == action) {
+            rule->gates |= pgm_read_byte(&dispatch_bit[gate]);
+            return;
+        }
+    }
+
+    if (table->numRules == DISPATCH_MAX_RULES) return;
+
+    for (uint8_t j = table->numRules++; j > i; j--) {
+        table->rules[j] = table->rules[j - 1];
+    }
+    table->rules[i] = (DispatchRule){status, data1, action, pgm_read_byte(&dispatch_bit[gate])};
+}
+
+// Takes the gates off every rule, dropping rules left without one. Order is kept.
+static void remove_gates(DispatchTable *table, uint8_t gates) {
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < table->numRules; i++) {
+        DispatchRule rule = table->rules[i];
+
+        rule.gates &= ~gates;
+        if (rule.gates) table->rules[kept++] = rule;
+    }
+    table->numRules = kept;
+}
+
+// Rebuilds the channel and data1 bitmaps from the rules.
+static void index_rules(DispatchTable *table) {
+    uint8_t *bits = (uint8_t *)table;
+
+    for (uint8_t i = 0; i < offsetof(DispatchTable, numRules); i++) {
+        bits[i] = 0;
+    }
+
+    for (uint8_t i = 0; i < table->numRules; i++) {
+        const DispatchRule *rule = &table->rules[i];
+        uint8_t kind = (rule->status >> 4) & 0x03;
+
+        bit_set(table->channels[kind], rule->status & 0x0F);
+        if (rule->data1 == DISPATCH_ANY) {
+            bit_set(table->anyChannels[kind], rule->status & 0x0F);
+        } else {
+            bit_set(table->data1[kind >> 1], rule->data1);
+        }
+    }
+}
+
+// Entries whose gate command is not a note keep their CV, step and reset rules.
+static void add_note_rules(DispatchTable *table, uint8_t command, uint8_t data1, uint8_t action, uint8_t gate) {
+    if (!IS_NOTE_ON(command) && !IS_NOTE_OFF(command)) return;
+
+    add_rule(table, command & 0xEF, data1, action, gate);  // Note Off
+    add_rule(table, command | 0x10, data1, action, gate);  // Note On
+}
+
+static void add_entry_rules(DispatchTable *table, const MIDIMapEntry *entry, uint8_t gate) {
+    uint8_t stepOnReset = entry->cvCommand1 == entry->cvCommand2 && entry->cvValue1 == entry->cvValue2;
+
+    switch (entry->mapType) {
+        case MIDIMAP_VELOCITY:
+            add_note_rules(table, entry->gateCommand, entry->gateValue, ACTION_GATE_VELOCITY, gate);
+            break;
+
+        case MIDIMAP_CC:
+            add_note_rules(table, entry->gateCommand, entry->gateValue, ACTION_GATE, gate);
+            add_rule(table, entry->cvCommand1, entry->cvValue1, ACTION_CV_CC, gate);
+            break;
+
+        case MIDIMAP_PITCH:
+            add_note_rules(table, entry->gateCommand, DISPATCH_ANY, ACTION_GATE_PITCH, gate);
+            break;
+
+        case MIDIMAP_PITCH_SAH:
+            add_note_rules(table, entry->gateCommand, entry->gateValue, ACTION_GATE_HOLD, gate);
+            add_rule(table, entry->cvCommand1, DISPATCH_ANY, ACTION_HOLD_PITCH, gate);
+            break;
+
+        case MIDIMAP_RANDSEQ:
+            add_note_rules(table, entry->gateCommand, entry->gateValue, ACTION_GATE, gate);
+            add_rule(table, entry->cvCommand1, entry->cvValue1, ACTION_STEP_WRITE, gate);
+            if (!stepOnReset) add_rule(table, entry->cvCommand2, entry->cvValue2, ACTION_RESET, gate);
+            break;
+
+        case MIDIMAP_RANDSEQ_SAH:
+            add_note_rules(table, entry->gateCommand, entry->gateValue, ACTION_GATE_HOLD, gate);
+            add_rule(table, entry->cvCommand1, entry->cvValue1, ACTION_STEP, gate);
+            if (!stepOnReset) add_rule(table, entry->cvCommand2, entry->cvValue2, ACTION_RESET, gate);
+            break;
+    }
+}
+
+void dispatch_compile(DispatchTable *table, const MIDIMapEntry *map) {
+    table->numRules = 0;
+    dispatch_update(table, map, 0xFF);
+}
+
+void dispatch_update(DispatchTable *table, const MIDIMapEntry *map, uint8_t gates) {
+    remove_gates(table, gates);
+    for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+        if (gates & pgm_read_byte(&dispatch_bit[gate])) add_entry_rules(table, &map[gate], gate);
+    }
+    index_rules(table);
+
+    clock_compile(map);
+}
+
+uint8_t dispatch_find(const DispatchTable *table, uint8_t status, uint8_t data1, const DispatchRule **rule) {
+    uint8_t kind = (status >> 4) & 0x03;
+    uint8_t channel = status & 0x0F;
+    uint8_t low = 0;
+    uint8_t high = table->numRules;
+    uint8_t count = 0;
+
+    if (status < 0x80 || status >= 0xC0 || !bit_test(table->channels[kind], channel)) return 0;
+
+    if (data1 == DISPATCH_ANY) {
+        if (!bit_test(table->anyChannels[kind], channel)) return 0;
+    } else if (!bit_test(table->data1[kind >> 1], data1)) {
+        return 0;
+    }
+
+    uint16_t key = rule_key(status, data1);
+    while (low < high) {
+        uint8_t mid = (low + high) >> 1;
+        if (rule_key(table->rules[mid].status, table->rules[mid].data1) < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *rule = &table->rules[low];
+    while (low + count < table->numRules &&
+           rule_key(table->rules[low + count].status, table->rules[low + count].data1) == key) {
+        count++;
+    }
+    return count;
+}
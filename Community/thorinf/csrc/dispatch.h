@@ -0,0 +1,66 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <avr/io.h>
+
+#include "hardware_config.h"
+#include "midi_parser.h"
+#include "midimap.h"
+
+// The MIDI map compiled into lookup tables, rebuilt whenever midi_map changes.
+// A message is first checked against a per-status channel bitmap and a data1 bitmap,
+// which rejects unmapped traffic in a few cycles. Matching messages binary search a
+// sorted rule list keyed on (status, data1); each rule carries the gates it drives.
+// MIDIMAP_CLOCK entries take no rules, dispatch_compile() hands them to clock_compile().
+//
+// Estimated cycles, 16 MHz ATmega8 (hand count):
+//                                  linear scan    tables
+//   status/channel not mapped          ~300         ~20
+//   channel mapped, data1 not          ~300         ~35
+//   matched, one rule                  ~300      ~90 + action
+#define DISPATCH_MAX_RULES (NUM_GATES * 4)
+#define DISPATCH_ANY 0x80  // data1 wildcard, any note inside the pitch table
+
+// Rule actions, applied to every gate in the rule
+#define ACTION_GATE_VELOCITY 0  // Gate follows the note, CV takes the velocity
+#define ACTION_GATE_PITCH 1     // Gate follows the note, CV takes the pitch
+#define ACTION_GATE_HOLD 2      // Gate follows the note, CV takes the held buffer
+#define ACTION_GATE 3           // Gate follows the note
+#define ACTION_CV_CC 4          // CV takes the controller value
+#define ACTION_HOLD_PITCH 5     // Held buffer takes the pitch
+#define ACTION_STEP_WRITE 6     // Sequence steps, CV takes the new value
+#define ACTION_STEP 7           // Sequence steps into the held buffer
+#define ACTION_RESET 8          // Sequence restarts from its seed
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t action;
+    uint8_t gates;
+} DispatchRule;
+
+typedef struct {
+    uint8_t channels[4][2];   // Channels with a rule, per Note Off/Note On/-/CC
+    uint8_t anyChannels[4][2];  // Channels with a DISPATCH_ANY rule
+    uint8_t data1[2][16];     // data1 values with a rule, per note/CC
+    uint8_t numRules;
+    DispatchRule rules[DISPATCH_MAX_RULES];  // Sorted by status, data1, action
+} DispatchTable;
+
+// Builds the table for the whole map.
+void dispatch_compile(DispatchTable *table, const MIDIMapEntry *map);
+
+// Rebuilds the rules of the gates set in gates from their entries in map, leaving the
+// rules of the other gates as they are, then the bitmaps and the clock gates. For a
+// preset switch or SysEx update that changes some of the map.
+//
+// Estimated cost (hand count, not measured on the hardware): ~0.2 ms for the bitmaps
+// and clock gates plus ~0.05-0.1 ms per gate rebuilt, depending on its rule count.
+// Rebuilding all eight gates with four rules each comes to ~1 ms.
+void dispatch_update(DispatchTable *table, const MIDIMapEntry *map, uint8_t gates);
+
+// Returns the number of rules for (status, data1) and points rule at the first.
+// Pass DISPATCH_ANY as data1 to get the wildcard rules for the status.
+uint8_t dispatch_find(const DispatchTable *table, uint8_t status, uint8_t data1, const DispatchRule **rule);
+
+#endif
@@ -0,0 +1,82 @@
+#include "eeprom_control.h"
+
+#include "midi_buffer.h"
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+EEPROM_Queue eepromQueue;
+
+uint8_t *eeprom_queue_claim(void) {
+    uint8_t *data = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (eepromQueue.state == EEPROM_IDLE) {
+            eepromQueue.state = EEPROM_CLAIMED;
+            data = eepromQueue.data;
+        }
+    }
+    return data;
+}
+
+void eeprom_queue_release(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (eepromQueue.state == EEPROM_CLAIMED) eepromQueue.state = EEPROM_IDLE;
+    }
+}
+
+void eeprom_queue_start(uint16_t address, uint8_t length) {
+    eepromQueue.address = address;
+    eepromQueue.length = length;
+    eepromQueue.index = 0;
+
+    MIDI_BARRIER();  // Block in place before EE_RDY_vect can see it
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        eepromQueue.state = EEPROM_WRITING;
+        eepromQueue.done = 0;
+        EECR |= (1 << EERIE);
+    }
+}
+
+uint8_t eeprom_queue_done(void) {
+    if (!eepromQueue.done) return 0;
+    eepromQueue.done = 0;
+    return 1;
+}
+
+void eeprom_queue_flush(void) {
+    while (eeprom_queue_busy());
+}
+
+// Runs whenever the EEPROM is idle and EERIE is set, so every return after starting a
+// write comes back here once that byte is programmed.
+ISR(EE_RDY_vect) {
+    uint8_t index = eepromQueue.index;
+
+    for (uint8_t compares = 0; compares < EEPROM_QUEUE_COMPARES; compares++) {
+        if (index == eepromQueue.length) {
+            EECR &= ~(1 << EERIE);
+            eepromQueue.state = EEPROM_IDLE;
+            eepromQueue.done = 1;
+            break;
+        }
+
+        uint8_t value = eepromQueue.data[index];
+        uint16_t address = eepromQueue.address + index++;
+
+        EEAR = address;
+        EECR |= (1 << EERE);
+        if (EEDR == value) {
+            eepromQueue.skipped++;
+            continue;
+        }
+
+        EEDR = value;
+        EECR |= (1 << EEMWE);  // EEWE has to follow within four cycles
+        EECR |= (1 << EEWE);
+        eepromQueue.written++;
+        break;
+    }
+
+    eepromQueue.index = index;
+}
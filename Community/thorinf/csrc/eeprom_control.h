@@ -0,0 +1,56 @@
+#ifndef EEPROM_CONTROL_H
+#define EEPROM_CONTROL_H
+
+#include <avr/io.h>
+
+// Background EEPROM writes through a single block buffer. Whoever fills the buffer
+// claims it first, the main loop for a record or the SysEx receiver for a payload
+// it stages in place, then either starts the write or releases it unwritten.
+// EE_RDY_vect programs the block one byte per interrupt. Each byte is read back
+// first and only programmed when it differs, so bytes the EEPROM already holds cost a
+// read instead of 8.5 ms. A record that is unchanged as a whole never gets here,
+// config_store skips the save.
+//
+// An interrupt compares at most EEPROM_QUEUE_COMPARES unchanged bytes before it returns,
+// ~10 us, and EE_RDY fires again at once for the rest. Reads elsewhere must not run
+// while the queue is busy, eeprom_queue_flush() waits for it.
+#define EEPROM_QUEUE_SIZE 64  // One config record
+#define EEPROM_QUEUE_COMPARES 8
+
+// Buffer states
+#define EEPROM_IDLE 0
+#define EEPROM_CLAIMED 1  // Being filled
+#define EEPROM_WRITING 2
+
+typedef struct {
+    uint8_t data[EEPROM_QUEUE_SIZE];
+    volatile uint8_t state;
+    uint8_t index;           // Next byte to write, only touched by EE_RDY_vect
+    uint8_t length;
+    uint16_t address;        // EEPROM address of data[0]
+    volatile uint8_t done;   // Set when a write has finished, cleared by eeprom_queue_done()
+    uint16_t written;        // Bytes programmed
+    uint16_t skipped;        // Bytes that already held their value
+} EEPROM_Queue;
+
+extern EEPROM_Queue eepromQueue;
+
+// Returns the buffer, now claimed, or 0 while it is claimed or being written.
+// Safe to call from an ISR.
+uint8_t *eeprom_queue_claim(void);
+
+// Gives up a claim without writing anything. Does nothing once the write has started.
+void eeprom_queue_release(void);
+
+// Writes the first length bytes of the claimed buffer from address on in the background.
+void eeprom_queue_start(uint16_t address, uint8_t length);
+
+static inline uint8_t eeprom_queue_busy(void) { return eepromQueue.state == EEPROM_WRITING; }
+
+// Returns 1 once after the queue has finished a write.
+uint8_t eeprom_queue_done(void);
+
+// Waits until every byte of the write is in the EEPROM.
+void eeprom_queue_flush(void);
+
+#endif
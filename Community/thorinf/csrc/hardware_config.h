@@ -7,6 +7,9 @@
 #define BAUD 31250UL
 #define MY_UBRR ((F_CPU / (16UL * BAUD)) - 1)
 
+// System tick, Timer2 in CTC mode
+#define TICK_PRESCALER 64UL
+
 // Gate control
 #define NUM_GATES 8
 
@@ -18,6 +21,12 @@
 #define GATE_DDR_D  DDRD
 #define GATE_PIN_1  PD1
 
+// Hardware revision strap, low on boards with non-inverting gate outputs
+#define HW_REVISION_PORT    PORTB
+#define HW_REVISION_DDR     DDRB
+#define HW_REVISION_PIN_REG PINB
+#define HW_REVISION_PIN     PB1
+
 // LED control
 #define LED_PORT PORTC
 #define LED_DDR  DDRC
@@ -42,6 +51,8 @@
 
 // EEPROM configuration
 #define EEPROM_BUTTON_FIX_ADDR 0x07
-#define EEPROM_MIDIMAP_ADDR    0x101
+#define EEPROM_TWI_BITRATE_ADDR 0x08  // TWBR followed by its complement
+#define EEPROM_STATUS_ADDR     0x10   // Status snapshot, see status.h
+#define EEPROM_CONFIG_ADDR     0x40   // Ring of config record slots, up to the end of the EEPROM
 
 #endif
\ No newline at end of file
@@ -5,7 +5,7 @@
 
 #define DEBOUNCE_TIME 50
 #define LONG_PRESS_TIME 2000
-#define TIMER_TICK 10
+#define TIMER_TICK 1  // ms per system tick
 #define DEBOUNCE_THRESHOLD (DEBOUNCE_TIME / TIMER_TICK)
 #define LONG_PRESS_THRESHOLD (LONG_PRESS_TIME / TIMER_TICK)
 
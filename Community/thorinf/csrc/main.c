@@ -1,91 +1,193 @@
+#include "clock.h"
+#include "config_store.h"
+#include "dispatch.h"
+#include "eeprom_control.h"
 #include "hardware_config.h"
 #include "max5825_control.h"
+#include "midi_buffer.h"
+#include "midi_parser.h"
 #include "midimap.h"
+#include "output.h"
 #include "pin_control.h"
 #include "pitch.h"
+#include "pulse.h"
 #include "random.h"
+#include "status.h"
+#include "sysex.h"
 #include "twi_control.h"
 #include "io.h"
 
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <stddef.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
-#define IS_NOTE_ON(command) (((command) & 0xF0) == 0x90)
-
 #define AWAITING_CC NUM_MIDIMAP_TYPES
 #define AWAITING_PITCH NUM_MIDIMAP_TYPES + 1
 #define AWAITING_STEP NUM_MIDIMAP_TYPES + 2
 #define AWAITING_RESET NUM_MIDIMAP_TYPES + 3
 
+#define LFSR_ROOT_SEED 0x0010
+
+#define PROGRAM_CHANNEL_DEFAULT 15  // Channel 16
+
+// Records waiting for room in the EEPROM queue
+#define SAVE_MAP 0x01
+#define SAVE_SETTINGS 0x02
+#define SAVE_STATUS 0x04
+
+#define DROP_FLASH_TICKS (100 / TIMER_TICK)
+
+// Payload of the CONFIG_KEY_SETTINGS record, put together in the EEPROM queue buffer.
+// Fields are only ever appended, see loadSettings().
 typedef struct {
-    uint8_t status;
-    uint8_t data1;
-    uint8_t data2;
-    volatile uint8_t ready;
-} MIDI_Message;
+    uint8_t programChannel;
+    GateTiming gateTiming[NUM_GATES];
+    LfsrLoop lfsrLoops[NUM_GATES];
+} Settings;
+
+#define SETTINGS_END(field) (offsetof(Settings, field) + sizeof(((Settings *)0)->field))
+
+#define TICK_COUNTS ((F_CPU / TICK_PRESCALER) * TIMER_TICK / 1000UL)
+
+#if TICK_COUNTS < 1 || TICK_COUNTS > 256
+#error "TIMER_TICK does not fit Timer2 at TICK_PRESCALER"
+#endif
 
 Button learnButton = {BUTTON_IDLE, 0, read_button};
 LED learnLED = {LED_OFF, 1, 0, 0, 0, 0, led_on, led_off};
-volatile MIDI_Message midiMsg = {0, 0, 0, 0};
+MIDI_Parser midiParser;
+MIDI_Buffer midiBuffer;
 MIDIMapEntry midi_map[NUM_GATES];
+DispatchTable dispatchTable;
+uint8_t pendingPreset = PRESET_NONE;  // User preset asked for while a save was being written
+uint8_t programChannel = PROGRAM_CHANNEL_DEFAULT;
 uint16_t dac_buffer[NUM_GATES];
+uint16_t lfsr_root = LFSR_ROOT_SEED;
 uint16_t lfsr_seeds[NUM_GATES];
+LfsrLoop lfsr_loops[NUM_GATES];
+uint16_t lfsr_starts[NUM_GATES];  // Seed moved on to the start of the loop
+uint8_t lfsr_steps[NUM_GATES];    // Steps since the start of the loop
 volatile uint8_t subRoutine = 0;
+uint8_t savePending = 0;
+volatile uint16_t uartOverruns = 0;
+volatile uint16_t uartFrameErrors = 0;
+uint16_t dropsShown = 0;  // Lost bytes and messages the LED has flashed for
+uint8_t dropFlash = 0;     // Ticks left of the current flash
+volatile uint8_t systemTicks = 0;
+volatile uint16_t midiStamp = 0;
 
 void setup(void);
 void USART_Init(unsigned int ubrr);
-void saveMidiMap(MIDIMapEntry *src, uint8_t *location);
-void loadMidiMap(MIDIMapEntry *dst, uint8_t *location);
-void copyMidiMap(MIDIMapEntry *src, MIDIMapEntry *dst);
-void sysExMidiMap(MIDIMapEntry *dst);
+void Tick_Init(void);
+uint8_t saveNext(void);
+uint8_t saveSettings(void);
+void loadSettings(void);
+uint8_t saveStatus(void);
+void showDrops(void);
+uint16_t savedMidiMap(uint8_t key);
+uint8_t loadMidiMap(uint8_t key, MIDIMapEntry *dst);
+void selectPreset(uint8_t preset);
+void applySysEx(void);
 void newSeeds(void);
 void resetDacBuffer(void);
-void handleMIDIMessage(void);
+void seekDacBuffer(uint16_t steps);
+void updateLoopStarts(void);
+void handleMIDIMessage(const MIDI_Message *msg);
+void dispatchMIDI(void);
 void midiLearn(void);
 
 void setup() {
     pin_initialize();
     twi_init();
+    max5825_probe_bitrate();
+    sei();  // DAC writes are interrupt driven
     max5825_init();
+    midi_parser_init(&midiParser);
     USART_Init(MY_UBRR);
-    loadMidiMap(midi_map, (uint8_t *)EEPROM_MIDIMAP_ADDR);
+    Tick_Init();
+    pulse_init();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    config_scan();
+    if (!loadMidiMap(CONFIG_KEY_MAP, midi_map)) {  // Nothing saved, or not usable
+        memcpy_P(midi_map, midi_map_velo, MIDI_MAP_SIZE);
+    }
+    loadSettings();
+    dispatch_compile(&dispatchTable, midi_map);
 
     for (uint8_t i = 0; i < NUM_GATES; i++) {
-        lfsr_seeds[i] = (i + 1) << 4;
+        lfsr_seeds[i] = splitLfsr(lfsr_root, i);
+        dac_buffer[i] = lfsr_seeds[i];
         gate_set(i, 1);
         _delay_ms(50);
     }
     gate_set_multiple(0xFF, 0);
-
-    sei();
+    updateLoopStarts();
 }
 
 int main(void) {
     setup();
     uint8_t menuState;
+    uint8_t lastTick = systemTicks;
 
     while (1) {
+        if (subRoutine == 0) {
+            dispatchMIDI();
+        }
+
+        // Idle until an interrupt brings work. Interrupts are enabled by the
+        // instruction right before SLEEP, so a wake-up cannot slip in between.
+        cli();
+        if (systemTicks == lastTick && !(subRoutine == 0 && midi_buffer_count(&midiBuffer)) && !output_pending()) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+
+        if (systemTicks == lastTick) {
+            continue;
+        }
+        lastTick++;  // Ticks missed during a long pass are caught up one per loop
+
+        // Records are written in the background, the LED blinks until the last byte is in
+        if (savePending && saveNext() && eeprom_queue_busy() && subRoutine != 2) learnLED.ledState = LED_BLINK4;
+        if (eeprom_queue_done() && subRoutine != 2) learnLED.ledState = LED_OFF;
+
         updateButton(&learnButton);
         updateLED(&learnLED);
-        _delay_ms(TIMER_TICK);
+        twi_watchdog();
 
         switch (subRoutine) {
             case 0:  // Normal play
+                showDrops();
                 if (learnButton.buttonState == BUTTON_RELEASED)
                     newSeeds();
                 else if (learnButton.buttonState == BUTTON_HELD) {
+                    pulse_clear();
+                    gate_set_multiple(0xFF, 0);
                     menuState = 0;
                     gate_set(menuState, 1);
                     subRoutine = 1;
+                    sysex_abort(&sysExReceiver);  // No longer fed, a message part way in would hold the buffer
+                    pendingPreset = PRESET_NONE;
                 }
                 break;
 
             case 1:  // In Menu
+                midi_buffer_flush(&midiBuffer);  // Nothing is played or learnt from the menu
+                if (sysExReceiver.ready) {
+                    sysex_release(&sysExReceiver);  // A map whose commit marker was flushed goes with it
+                }
+
                 if (learnButton.buttonState == BUTTON_RELEASED) {
                     gate_set(menuState, 0);
-                    menuState = (menuState + 1) % 6;
+                    menuState = (menuState + 1) % 5;
                     gate_set(menuState, 1);
                 } else if (learnButton.buttonState == BUTTON_HELD) {
                     gate_set(menuState, 0);
@@ -97,22 +199,19 @@ int main(void) {
                             subRoutine = 2;
                             break;
                         case 1:
-                            saveMidiMap(midi_map, (uint8_t *)EEPROM_MIDIMAP_ADDR);
+                            savePending |= SAVE_MAP;
                             subRoutine = 0;
                             break;
                         case 2:
-                            loadMidiMap(midi_map, (uint8_t *)EEPROM_MIDIMAP_ADDR);
+                            loadMidiMap(CONFIG_KEY_MAP, midi_map);
+                            dispatch_compile(&dispatchTable, midi_map);
                             subRoutine = 0;
                             break;
                         case 3:
-                            copyMidiMap(midi_map_bsp, midi_map);
+                            selectPreset(PRESET_BSP);
                             subRoutine = 0;
                             break;
                         case 4:
-                            sysExMidiMap(midi_map);
-                            subRoutine = 0;
-                            break;
-                        case 5:
                             subRoutine = 0;
                             break;
                     }
@@ -133,265 +232,544 @@ void USART_Init(unsigned int ubrr) {
     UCSRC = (1 << URSEL) | (1 << UCSZ1) | (1 << UCSZ0);
 }
 
+void Tick_Init() {
+    OCR2 = TICK_COUNTS - 1;
+    TCCR2 = (1 << WGM21) | (1 << CS22);  // CTC, F_CPU / 64
+    TIMSK |= (1 << OCIE2);
+}
+
+ISR(TIMER2_COMP_vect) { systemTicks++; }
+
+// Byte capture, parsing and the SysEx receiver are straight-line code, ~200 cycles
+// (~13 us) a byte. Real-time bytes also run the clock fast path, clock_realtime(),
+// whose loops are fixed at NUM_GATES counters plus one pulse_trigger() insert into
+// the deadline list of at most NUM_GATES events, ~500 cycles with the PLL update.
+// Either is well inside the 5120 cycles between bytes at 31250 baud. All other
+// output work is done by dispatchMIDI() from the main loop.
 ISR(USART_RXC_vect) {
-    static uint8_t midiState = 0;
+    uint8_t errors = UCSRA & ((1 << FE) | (1 << DOR));  // Must be read before UDR
     uint8_t byte = UDR;
+    MIDI_Message msg;
 
-    switch (midiState) {
-        case 0:
-            if (byte >= 0x80 && byte < 0xF0) {
-                midiMsg.status = byte;
-                midiState = (byte & 0xF0) == 0xD0 ? 1 : 2;
-            }
-            break;
-        case 1:
-            midiMsg.data1 = byte;
-            midiState = 0;
-            break;
-        case 2:
-            midiMsg.data1 = byte;
-            midiState = 3;
-            break;
-        case 3:
-            midiMsg.data2 = byte;
-            midiMsg.ready = 1;
-            midiState = 0;
-            if (!subRoutine) {
-                handleMIDIMessage();
-            }
-            break;
+    if (errors) {
+        if (errors & (1 << DOR)) uartOverruns++;
+        if (errors & (1 << FE)) uartFrameErrors++;
+        midi_parser_abort(&midiParser);
+        if (errors & (1 << FE)) return;  // The byte itself is garbage
     }
-}
 
-void saveMidiMap(MIDIMapEntry *src, uint8_t *location) {
-    while (!eeprom_is_ready());
-    eeprom_write_block((const void *)src, (void *)location, sizeof(midi_map));
+    if (IS_REALTIME(byte)) {
+        if (subRoutine == 0) clock_realtime(byte);  // Never queued, timing is the payload
+        return;
+    }
+
+    if (subRoutine == 0 && sysex_receive(&sysExReceiver, byte)) {
+        // Committed in order with the messages around it, see applySysEx()
+        if (!midi_buffer_push(&midiBuffer, MIDI_SYSEX_END, 0, 0)) sysex_release(&sysExReceiver);
+    }
+
+    if (midi_parse(&midiParser, byte, &msg)) {
+        midi_buffer_push(&midiBuffer, msg.status, msg.data1, msg.data2);
+        midiStamp = TCNT1;
+    }
 }
 
-void loadMidiMap(MIDIMapEntry *dst, uint8_t *location) {
-    while (!eeprom_is_ready());
-    eeprom_read_block((void *)dst, (const void *)location, sizeof(midi_map));
+// Queues one of the records savePending asks for, the queue holds no more. Returns 0
+// while an earlier record still fills it, nothing is copied then.
+uint8_t saveNext() {
+    if (savePending & SAVE_MAP) {
+        if (!config_save(CONFIG_KEY_MAP, midi_map, MIDI_MAP_SIZE)) return 0;
+        savePending &= ~SAVE_MAP;
+    } else if (savePending & SAVE_SETTINGS) {
+        if (!saveSettings()) return 0;
+        savePending &= ~SAVE_SETTINGS;
+    } else if (savePending & SAVE_STATUS) {
+        if (!saveStatus()) return 0;
+        savePending &= ~SAVE_STATUS;
+    }
+    return 1;
 }
 
-void copyMidiMap(MIDIMapEntry *src, MIDIMapEntry *dst) {
+uint8_t saveSettings() {
+    Settings *settings = (Settings *)config_claim();
+
+    if (!settings) return 0;
+
+    settings->programChannel = programChannel;
     for (uint8_t i = 0; i < NUM_GATES; i++) {
-        dst[i] = src[i];
+        settings->gateTiming[i] = gate_timing[i];
+        settings->lfsrLoops[i] = lfsr_loops[i];
     }
+    return config_commit(CONFIG_KEY_SETTINGS, sizeof(Settings));
 }
 
-void sysExMidiMap(MIDIMapEntry *dst) {
-    uint8_t sysExBuffer[114];
-    uint8_t *bufferPtr = sysExBuffer;
+// A record saved by an older firmware, e.g. one holding just the Program Change
+// channel, sets the fields it has and leaves the rest at their defaults.
+void loadSettings() {
+    uint8_t length = config_length(CONFIG_KEY_SETTINGS);
+    uint16_t address = config_payload(CONFIG_KEY_SETTINGS, length);
 
-    cli();
-    gate_set_multiple(0x81, 1);
+    if (!address) return;
 
-    for (uint8_t i = 0; i < sizeof(sysExBuffer); i++) {
-        while (!(UCSRA & (1 << RXC)));
-        sysExBuffer[i] = UDR;
+    if (length >= SETTINGS_END(programChannel)) {
+        uint8_t channel = eeprom_read_byte((const uint8_t *)(address + offsetof(Settings, programChannel)));
+        if (channel < 16 || channel == SYSEX_CHANNEL_OFF) programChannel = channel;
     }
+    if (length >= SETTINGS_END(gateTiming)) {
+        eeprom_read_block(gate_timing, (const void *)(address + offsetof(Settings, gateTiming)), sizeof(gate_timing));
+    }
+    if (length >= SETTINGS_END(lfsrLoops)) {
+        eeprom_read_block(lfsr_loops, (const void *)(address + offsetof(Settings, lfsrLoops)), sizeof(lfsr_loops));
+    }
+}
 
-    gate_set_multiple(0x81, 0);
+// Writes the diagnostic counters to EEPROM_STATUS_ADDR, there being no MIDI output to
+// send them back on. Taken together, so they all describe the same moment.
+uint8_t saveStatus() {
+    StatusRecord *status = (StatusRecord *)eeprom_queue_claim();
+
+    if (!status) return 0;
+
+    status->magic = STATUS_MAGIC;
+    status->version = STATUS_VERSION;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        status->uartOverruns = uartOverruns;
+        status->uartFrameErrors = uartFrameErrors;
+        status->midiOverflows = midiBuffer.overflows;
+        status->midiHighWater = midiBuffer.highWater;
+        status->sysExAccepted = sysExReceiver.accepted;
+        status->sysExRejected = sysExReceiver.rejected;
+        status->twiErrors = twiQueue.errors;
+        status->twiRecoveries = twiQueue.recoveries;
+        status->latencyLast = outputLatency.last;
+        status->latencyMax = outputLatency.max;
+        status->phaseError = clockPll.phaseError;
+        status->phaseErrorMax = clockPll.phaseErrorMax;
+    }
+    status->settle = output_settle;
+#ifdef OUTPUT_GATE_FIRST
+    status->flags = STATUS_GATE_FIRST;
+#else
+    status->flags = 0;
+#endif
+    eeprom_queue_start(EEPROM_STATUS_ADDR, sizeof(StatusRecord));
+    return 1;
+}
 
-    if ((sysExBuffer[0] != 0xF0) || (sysExBuffer[113] != 0xF7)) {
-        gate_set_multiple(0xFF, 1);
-        _delay_ms(50);
-        gate_set_multiple(0xFF, 0);
-        sei();
-        return;
+// Lights the LED briefly during play whenever a byte or message has been lost since it
+// last looked, unless the LED is showing something else. The counts themselves are in
+// the status snapshot.
+void showDrops() {
+    uint16_t drops;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { drops = uartOverruns + uartFrameErrors + midiBuffer.overflows; }
+
+    if (drops != dropsShown && learnLED.ledState == LED_OFF) {
+        dropsShown = drops;
+        dropFlash = DROP_FLASH_TICKS;
+        learnLED.ledState = LED_ON;
+    } else if (dropFlash && !--dropFlash && learnLED.ledState == LED_ON) {
+        learnLED.ledState = LED_OFF;
     }
+}
+
+// EEPROM address of the map saved under key, 0 when there is none or it holds an
+// unknown type. Checked in place, so no RAM is needed for a second map.
+uint16_t savedMidiMap(uint8_t key) {
+    uint16_t address = config_payload(key, MIDI_MAP_SIZE);
+
+    if (!address) return 0;
 
-    uint8_t index = 1;
     for (uint8_t i = 0; i < NUM_GATES; i++) {
-        dst[i].mapType = sysExBuffer[index] | (sysExBuffer[index + 1] << 7);
-        dst[i].gateCommand = sysExBuffer[index + 2] | (sysExBuffer[index + 3] << 7);
-        dst[i].gateValue = sysExBuffer[index + 4] | (sysExBuffer[index + 5] << 7);
-        dst[i].cvCommand1 = sysExBuffer[index + 6] | (sysExBuffer[index + 7] << 7);
-        dst[i].cvValue1 = sysExBuffer[index + 8] | (sysExBuffer[index + 9] << 7);
-        dst[i].cvCommand2 = sysExBuffer[index + 10] | (sysExBuffer[index + 11] << 7);
-        dst[i].cvValue2 = sysExBuffer[index + 12] | (sysExBuffer[index + 13] << 7);
+        if (eeprom_read_byte((const uint8_t *)(address + i * sizeof(MIDIMapEntry))) >= NUM_MIDIMAP_TYPES) return 0;
+    }
+    return address;
+}
 
-        index += 14;
+// Returns 0, leaving dst alone, when no valid map has been saved under key.
+uint8_t loadMidiMap(uint8_t key, MIDIMapEntry *dst) {
+    uint16_t address = savedMidiMap(key);
 
-        gate_set_multiple(i, 1);
-        _delay_ms(50);
+    if (!address) return 0;
+
+    eeprom_read_block(dst, (const void *)address, MIDI_MAP_SIZE);
+    return 1;
+}
+
+// A note held under an entry that is replaced would never see its off, so the gates
+// of changed entries are released.
+static inline void releaseGates(uint8_t gates) {
+    for (uint8_t i = 0; i < NUM_GATES; i++) {
+        if (gates & (1 << i)) output_gate(i, 0);
     }
-    gate_set_multiple(0xFF, 0);
-    sei();
+}
+
+// Program Change, or Copy Preset from the menu. The preset is copied over midi_map a
+// byte at a time from flash or EEPROM, noting the entries that change, and only their
+// rules are rebuilt: ~0.1 ms for the copy plus dispatch_update(), ~0.3-0.5 ms when a few
+// gates change and ~1 ms when all eight change to four-rule modes (hand counts, not
+// measured). Messages arriving meanwhile wait in the ring. An empty user slot leaves
+// the map as it is.
+//
+// A user preset cannot be read while a save is being written, and waiting for it
+// would hold up every gate for up to ~0.5 s, so it is left in pendingPreset for
+// dispatchMIDI() to apply once the EEPROM is free. The old map plays until then.
+void selectPreset(uint8_t preset) {
+    uint8_t *map = (uint8_t *)midi_map;
+    const uint8_t *builtin = 0;
+    uint16_t address = 0;
+    uint8_t changed = 0;
+
+    pendingPreset = PRESET_NONE;  // The newest Program Change wins
+    if (preset < PRESET_BUILTIN) {
+        builtin = (const uint8_t *)pgm_read_ptr(&midi_presets[preset]);
+    } else if (preset < NUM_PRESETS) {
+        if (eeprom_queue_busy()) {
+            pendingPreset = preset;
+            return;
+        }
+        address = savedMidiMap(CONFIG_KEY_PRESET + preset - PRESET_BUILTIN);
+        if (!address) return;
+    } else {
+        return;
+    }
+
+    for (uint8_t i = 0; i < MIDI_MAP_SIZE; i++) {
+        uint8_t value = builtin ? pgm_read_byte(builtin + i) : eeprom_read_byte((const uint8_t *)(address + i));
+
+        if (map[i] != value) {
+            changed |= 1 << (i / sizeof(MIDIMapEntry));
+            map[i] = value;
+        }
+    }
+
+    if (!changed) return;
+
+    releaseGates(changed);
+    dispatch_update(&dispatchTable, midi_map, changed);
+}
+
+// Runs when the commit marker comes out of the ring, so messages sent before the SysEx
+// still play on the old map and those after it on the new one.
+void applySysEx() {
+    uint8_t changed;
+
+    switch (sysExReceiver.command) {
+        case SYSEX_CMD_PRESET:
+            // Staged in the EEPROM queue buffer, so the record is written from where it was received
+            if (sysex_check(&sysExReceiver) &&
+                config_commit(CONFIG_KEY_PRESET + sysExReceiver.argument, MIDI_MAP_SIZE) && eeprom_queue_busy()) {
+                learnLED.ledState = LED_BLINK4;
+            }
+            sysex_release(&sysExReceiver);
+            return;
+
+        case SYSEX_CMD_PROGRAM_CHANNEL:
+            programChannel = sysExReceiver.argument;
+            sysex_release(&sysExReceiver);
+            savePending |= SAVE_SETTINGS;
+            return;
+
+        case SYSEX_CMD_GATE_TIMING:
+            // The pulse engine reads it from Timer1 interrupts
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                gate_timing[sysExReceiver.argument] = *(const GateTiming *)sysExReceiver.staged;
+            }
+            sysex_release(&sysExReceiver);
+            savePending |= SAVE_SETTINGS;
+            return;
+
+        case SYSEX_CMD_LOOP:
+            lfsr_loops[sysExReceiver.argument] = *(const LfsrLoop *)sysExReceiver.staged;
+            sysex_release(&sysExReceiver);
+            updateLoopStarts();
+            savePending |= SAVE_SETTINGS;
+            return;
+
+        case SYSEX_CMD_STATUS:
+            sysex_release(&sysExReceiver);
+            savePending |= SAVE_STATUS;
+            return;
+    }
+
+    changed = sysex_commit(&sysExReceiver, midi_map);
+    if (!changed) return;
+
+    releaseGates(changed);
+    dispatch_update(&dispatchTable, midi_map, changed);
 }
 
 void resetDacBuffer() {
     for (uint8_t i = 0; i < NUM_GATES; i++) {
         uint8_t mapType = midi_map[i].mapType;
         if (mapType == MIDIMAP_RANDSEQ || mapType == MIDIMAP_RANDSEQ_SAH) {
-            dac_buffer[i] = lfsr_seeds[i];
+            dac_buffer[i] = lfsr_starts[i];
+            lfsr_steps[i] = 0;
         }
     }
 }
 
+// Random sequences step once per sixteenth, so a song position is a step count from
+// the start of the loop.
+void seekDacBuffer(uint16_t steps) {
+    for (uint8_t i = 0; i < NUM_GATES; i++) {
+        uint8_t mapType = midi_map[i].mapType;
+        if (mapType == MIDIMAP_RANDSEQ || mapType == MIDIMAP_RANDSEQ_SAH) {
+            uint16_t step = steps;
+            if (lfsr_loops[i].length) {
+                step %= lfsr_loops[i].length;
+                lfsr_steps[i] = step;
+            }
+            dac_buffer[i] = lfsrSeek(lfsr_starts[i], step);
+        }
+    }
+}
+
+// Call whenever a seed or a loop start changes.
+void updateLoopStarts() {
+    for (uint8_t i = 0; i < NUM_GATES; i++) {
+        lfsr_starts[i] = lfsrSeek(lfsr_seeds[i], lfsr_loops[i].start);
+    }
+}
+
+static inline uint16_t stepSequence(uint8_t gateIndex) {
+    uint8_t length = lfsr_loops[gateIndex].length;
+
+    if (length && ++lfsr_steps[gateIndex] >= length) {
+        lfsr_steps[gateIndex] = 0;
+        dac_buffer[gateIndex] = lfsr_starts[gateIndex];
+        return dac_buffer[gateIndex];
+    }
+    return stepLfsr(&dac_buffer[gateIndex]);
+}
+
 void newSeeds() {
+    // The other register, stepping the root with stepLfsr() would only shift every sequence
+    updateLfsrAlt(&lfsr_root);
+    if (!lfsr_root) lfsr_root = LFSR_ROOT_SEED;
+
     for (uint8_t i = 0; i < NUM_GATES; i++) {
         uint8_t mapType = midi_map[i].mapType;
         if (mapType == MIDIMAP_RANDSEQ || mapType == MIDIMAP_RANDSEQ_SAH) {
-            updateLfsrAlt(&lfsr_seeds[i]);
+            lfsr_seeds[i] = splitLfsr(lfsr_root, i);
         }
     }
+    updateLoopStarts();
 }
 
-inline void handleMIDIMessage() {
-    uint8_t gateIndex = 0;
-    uint8_t commandFiltered = midiMsg.status & 0xEF;
-    uint8_t noteOnFlag = IS_NOTE_ON(midiMsg.status);
-    uint8_t data1 = midiMsg.data1;
+static inline void runRule(const DispatchRule *rule, const MIDI_Message *msg, uint8_t *gatesDone) {
+    uint8_t noteOnFlag = IS_NOTE_ON(msg->status);
+    uint8_t gates = rule->gates;
 
-    while (gateIndex < NUM_GATES) {
-        MIDIMapEntry *mapEntry = &midi_map[gateIndex];
-        uint8_t gateCommand = mapEntry->gateCommand & 0xEF;
+    for (uint8_t gateIndex = 0; gates; gateIndex++, gates >>= 1) {
+        if (!(gates & 1)) continue;
 
-        switch (mapEntry->mapType) {
-            case MIDIMAP_VELOCITY:
-                if (commandFiltered == gateCommand && data1 == mapEntry->gateValue) {
-                    gate_set(gateIndex, noteOnFlag);
-                    max5825_write(gateIndex, noteOnFlag ? midiMsg.data2 << 9 : 0);  // 7-bit to 16-bit
-                }
+        switch (rule->action) {
+            case ACTION_GATE_VELOCITY:
+                output_gate(gateIndex, noteOnFlag);
+                output_cv(gateIndex, noteOnFlag ? msg->data2 << 9 : 0);  // 7-bit to 16-bit
                 break;
 
-            case MIDIMAP_CC:
-                if (commandFiltered == gateCommand && data1 == mapEntry->gateValue) {
-                    gate_set(gateIndex, noteOnFlag);
-                } else if (midiMsg.status == mapEntry->cvCommand1 && data1 == mapEntry->cvValue1) {
-                    max5825_write(gateIndex, midiMsg.data2 << 9);
-                }
+            case ACTION_GATE_PITCH:
+                output_gate(gateIndex, noteOnFlag);
+                output_cv(gateIndex, pgm_read_word(&pitch_lookup[msg->data1]));
                 break;
 
-            case MIDIMAP_PITCH:
-                if (commandFiltered == gateCommand && data1 < PITCH_SIZE) {
-                    gate_set(gateIndex, noteOnFlag);
-                    max5825_write(gateIndex, pitch_lookup[data1]);
-                }
+            case ACTION_GATE_HOLD:
+                output_gate(gateIndex, noteOnFlag);
+                output_cv(gateIndex, dac_buffer[gateIndex]);
                 break;
 
-            case MIDIMAP_PITCH_SAH:
-                if (commandFiltered == gateCommand && data1 == mapEntry->gateValue) {
-                    gate_set(gateIndex, noteOnFlag);
-                    max5825_write(gateIndex, dac_buffer[gateIndex]);
-                } else if (commandFiltered == mapEntry->cvCommand1 && data1 < PITCH_SIZE) {
-                    dac_buffer[gateIndex] = pitch_lookup[data1];
-                }
+            case ACTION_GATE:
+                output_gate(gateIndex, noteOnFlag);
                 break;
 
-            case MIDIMAP_RANDSEQ:
-                if (commandFiltered == gateCommand && data1 == mapEntry->gateValue) {
-                    gate_set(gateIndex, noteOnFlag);
-                }
-                if (midiMsg.status == mapEntry->cvCommand1 && data1 == mapEntry->cvValue1) {
-                    max5825_write(gateIndex, updateLfsr(&dac_buffer[gateIndex]));
-                } else if (midiMsg.status == mapEntry->cvCommand2 && data1 == mapEntry->cvValue2) {
-                    dac_buffer[gateIndex] = lfsr_seeds[gateIndex];
-                }
+            case ACTION_CV_CC:
+                output_cv(gateIndex, msg->data2 << 9);
                 break;
 
-            case MIDIMAP_RANDSEQ_SAH:
-                if (commandFiltered == gateCommand && data1 == mapEntry->gateValue) {
-                    gate_set(gateIndex, noteOnFlag);
-                    max5825_write(gateIndex, dac_buffer[gateIndex]);
-                }
-                if (midiMsg.status == mapEntry->cvCommand1 && data1 == mapEntry->cvValue1) {
-                    updateLfsr(&dac_buffer[gateIndex]);
-                } else if (midiMsg.status == mapEntry->cvCommand2 && data1 == mapEntry->cvValue2) {
-                    dac_buffer[gateIndex] = lfsr_seeds[gateIndex];
+            case ACTION_HOLD_PITCH:
+                if (!(*gatesDone & (1 << gateIndex))) {  // The gate note itself is not held
+                    dac_buffer[gateIndex] = pgm_read_word(&pitch_lookup[msg->data1]);
                 }
                 break;
+
+            case ACTION_STEP_WRITE:
+                output_cv(gateIndex, stepSequence(gateIndex));
+                break;
+
+            case ACTION_STEP:
+                stepSequence(gateIndex);
+                break;
+
+            case ACTION_RESET:
+                dac_buffer[gateIndex] = lfsr_starts[gateIndex];
+                lfsr_steps[gateIndex] = 0;
+                break;
         }
+    }
 
-        gateIndex++;
+    if (rule->action <= ACTION_GATE) {
+        *gatesDone |= rule->gates;
+    }
+}
+
+inline void handleMIDIMessage(const MIDI_Message *msg) {
+    const DispatchRule *rule;
+    uint8_t gatesDone = 0;
+    uint8_t count;
+
+    if (msg->status == MIDI_SYSEX_END) {
+        applySysEx();
+        return;
     }
 
-    midiMsg.ready = 0;
+    if (IS_PROGRAM_CHANGE(msg->status) && (msg->status & 0x0F) == programChannel) {
+        selectPreset(msg->data1);
+        return;
+    }
+
+    if (msg->status == MIDI_SONG_POSITION) {
+        uint16_t position = msg->data1 | (msg->data2 << 7);
+        clock_seek(position);
+        seekDacBuffer(position);
+        return;
+    }
+
+    count = dispatch_find(&dispatchTable, msg->status, msg->data1, &rule);
+    while (count--) {
+        runRule(rule++, msg, &gatesDone);
+    }
+
+    if (msg->data1 < PITCH_SIZE) {
+        count = dispatch_find(&dispatchTable, msg->status, DISPATCH_ANY, &rule);
+        while (count--) {
+            runRule(rule++, msg, &gatesDone);
+        }
+    }
+}
+
+// Everything waiting is applied as one frame, so a chord lands on all of its
+// gates at once and repeated writes to a DAC channel collapse into one.
+void dispatchMIDI() {
+    MIDI_Message msg;
+    uint16_t stamp;
+
+    uint8_t switching = pendingPreset != PRESET_NONE && !eeprom_queue_busy();
+
+    if (!switching && !midi_buffer_count(&midiBuffer) && !output_pending()) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { stamp = midiStamp; }
+    output_begin(stamp);
+    if (switching) selectPreset(pendingPreset);
+    while (midi_buffer_pop(&midiBuffer, &msg)) {
+        handleMIDIMessage(&msg);
+    }
+    output_commit();
 }
 
 inline void midiLearn() {
     static uint8_t learningIndex = 0;
     static uint8_t learningMapType = MIDIMAP_VELOCITY;
-    uint8_t nextGateFlag = 0;
+    MIDI_Message msg;
 
-    if (midiMsg.ready) {
+    while (learningIndex < NUM_GATES && midi_buffer_pop(&midiBuffer, &msg)) {
+        uint8_t nextGateFlag = 0;
         MIDIMapEntry *mapEntry = &midi_map[learningIndex];
         switch (learningMapType) {
             case MIDIMAP_VELOCITY:
-                if (IS_NOTE_ON(midiMsg.status)) {
+                if (IS_NOTE_ON(msg.status)) {
                     mapEntry->mapType = learningMapType;
-                    mapEntry->gateCommand = midiMsg.status;
-                    mapEntry->gateValue = midiMsg.data1;
+                    mapEntry->gateCommand = msg.status;
+                    mapEntry->gateValue = msg.data1;
                     nextGateFlag = 1;
                 }
                 break;
             case MIDIMAP_CC:
-                if (IS_NOTE_ON(midiMsg.status)) {
+                if (IS_NOTE_ON(msg.status)) {
                     mapEntry->mapType = learningMapType;
-                    mapEntry->gateCommand = midiMsg.status;
-                    mapEntry->gateValue = midiMsg.data1;
+                    mapEntry->gateCommand = msg.status;
+                    mapEntry->gateValue = msg.data1;
                     learningMapType = AWAITING_CC;
                     learnLED.ledState = LED_BLINK2;
                 }
                 break;
             case MIDIMAP_PITCH:
-                if (IS_NOTE_ON(midiMsg.status)) {
+                if (IS_NOTE_ON(msg.status)) {
                     mapEntry->mapType = learningMapType;
-                    mapEntry->gateCommand = midiMsg.status;
+                    mapEntry->gateCommand = msg.status;
                     nextGateFlag = 1;
                 }
                 break;
             case MIDIMAP_PITCH_SAH:
-                if (IS_NOTE_ON(midiMsg.status)) {
+                if (IS_NOTE_ON(msg.status)) {
                     mapEntry->mapType = learningMapType;
-                    mapEntry->gateCommand = midiMsg.status;
-                    mapEntry->gateValue = midiMsg.data1;
+                    mapEntry->gateCommand = msg.status;
+                    mapEntry->gateValue = msg.data1;
                     learningMapType = AWAITING_PITCH;
                     learnLED.ledState = LED_BLINK2;
                 }
                 break;
             case MIDIMAP_RANDSEQ:
             case MIDIMAP_RANDSEQ_SAH:
-                if (IS_NOTE_ON(midiMsg.status)) {
+                if (IS_NOTE_ON(msg.status)) {
                     mapEntry->mapType = learningMapType;
-                    mapEntry->gateCommand = midiMsg.status;
+                    mapEntry->gateCommand = msg.status;
                     learningMapType = AWAITING_STEP;
                     learnLED.ledState = LED_BLINK2;
                 }
                 break;
+            case MIDIMAP_CLOCK:
+                if (IS_NOTE_ON(msg.status)) {
+                    mapEntry->mapType = learningMapType;
+                    mapEntry->gateCommand = MIDI_CLOCK;
+                    mapEntry->gateValue = pgm_read_byte(&clock_learn_divisions[msg.data1 % CLOCK_LEARN_DIVISIONS]);
+                    mapEntry->cvCommand1 = 0;  // Offset
+                    mapEntry->cvValue1 = 1;    // Reset on start
+                    mapEntry->cvCommand2 = 0;
+                    mapEntry->cvValue2 = 0;
+                    nextGateFlag = 1;
+                }
+                break;
             case AWAITING_CC:
-                if ((midiMsg.status & 0xF0) == 0xB0) {
-                    mapEntry->cvCommand1 = midiMsg.status;
-                    mapEntry->cvValue1 = midiMsg.data1;
+                if ((msg.status & 0xF0) == 0xB0) {
+                    mapEntry->cvCommand1 = msg.status;
+                    mapEntry->cvValue1 = msg.data1;
                     nextGateFlag = 1;
                 }
                 break;
             case AWAITING_PITCH:
-                if (IS_NOTE_ON(midiMsg.status)) {
-                    mapEntry->cvCommand1 = midiMsg.status;
+                if (IS_NOTE_ON(msg.status)) {
+                    mapEntry->cvCommand1 = msg.status;
                     nextGateFlag = 1;
                 }
                 break;
             case AWAITING_STEP:
-                if (IS_NOTE_ON(midiMsg.status)) {
-                    mapEntry->cvCommand1 = midiMsg.status;
-                    mapEntry->cvValue1 = midiMsg.data1;
+                if (IS_NOTE_ON(msg.status)) {
+                    mapEntry->cvCommand1 = msg.status;
+                    mapEntry->cvValue1 = msg.data1;
                     learningMapType = AWAITING_RESET;
                     learnLED.ledState = LED_BLINK3;
                 }
                 break;
             case AWAITING_RESET:
-                if (IS_NOTE_ON(midiMsg.status)) {
-                    mapEntry->cvCommand2 = midiMsg.status;
-                    mapEntry->cvValue2 = midiMsg.data1;
+                if (IS_NOTE_ON(msg.status)) {
+                    mapEntry->cvCommand2 = msg.status;
+                    mapEntry->cvValue2 = msg.data1;
                     nextGateFlag = 1;
                 }
                 break;
             default:
                 break;
         }
-        midiMsg.ready = 0;
+
+        if (nextGateFlag) {
+            gate_set(learningIndex, 1);
+            learningIndex++;
+            learningMapType = MIDIMAP_VELOCITY;
+            learnLED.ledState = LED_BLINK1;
+            learnLED.ledBlinkCount = 1;
+        }
     }
 
     if (learnButton.buttonState == BUTTON_RELEASED) {
@@ -401,6 +779,7 @@ inline void midiLearn() {
             case MIDIMAP_PITCH:
             case MIDIMAP_PITCH_SAH:
             case MIDIMAP_RANDSEQ:
+            case MIDIMAP_RANDSEQ_SAH:
                 learningMapType++;
                 learnLED.ledState = LED_BLINK1;
                 learnLED.ledBlinkCount = learningMapType + 1;
@@ -413,14 +792,6 @@ inline void midiLearn() {
         }
     }
 
-    if (nextGateFlag) {
-        gate_set(learningIndex, 1);
-        learningIndex++;
-        learningMapType = MIDIMAP_VELOCITY;
-        learnLED.ledState = LED_BLINK1;
-        learnLED.ledBlinkCount = 1;
-    }
-
     if (learningIndex == NUM_GATES || learnButton.buttonState == BUTTON_HELD) {
         gate_set_multiple(0xFF, 1);
         _delay_ms(50);
@@ -430,6 +801,7 @@ inline void midiLearn() {
         learnLED.ledState = LED_OFF;
         learnLED.ledBlinkCount = 1;
         learningIndex = 0;
+        dispatch_compile(&dispatchTable, midi_map);
         subRoutine = 0;
     }
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "max5825_control.h"
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "hardware_config.h"
+
+MAX5825_Shadow max5825_shadow;
+
+static uint8_t batch[MAX5825_CHANNELS * 3];
+
+// Probe candidates, fastest first. The ATmega8 datasheet only guarantees master mode for
+// TWBR >= 10, which is why every rate below that has to earn its place by read-back.
+static const uint8_t max5825_bitrates[] PROGMEM = {0, 2, 4, 7, TWI_TWBR(400000UL)};  // 1 MHz to 400 kHz
+static const uint16_t max5825_patterns[] PROGMEM = {0xAAA0, 0x5550, 0xFFF0, 0x0F00, 0xF0F0, 0x0000};
+
+static uint8_t max5825_write_blocking(uint8_t command, uint16_t value) {
+    uint8_t ok = twi_start() && twi_write(MAX5825_ADDR | MAX5825_WRITE) && twi_write(command) &&
+                 twi_write((uint8_t)(value >> 8)) && twi_write((uint8_t)(value & 0xF0));
+    twi_stop();
+    return ok;
+}
+
+static uint8_t max5825_read_blocking(uint8_t command, uint16_t *value) {
+    uint8_t high, low;
+    uint8_t ok = twi_start() && twi_write(MAX5825_ADDR | MAX5825_WRITE) && twi_write(command) && twi_start() &&
+                 twi_write(MAX5825_ADDR | MAX5825_READ) && twi_read(&high, 1) && twi_read(&low, 0);
+    twi_stop();
+    *value = ((uint16_t)high << 8) | (low & 0xF0);
+    return ok;
+}
+
+static uint8_t max5825_verify(uint8_t twbr) {
+    twi_set_bitrate(twbr);
+
+    for (uint8_t i = 0; i < sizeof(max5825_patterns) / sizeof(max5825_patterns[0]); i++) {
+        uint16_t code = pgm_read_word(&max5825_patterns[i]);
+        uint16_t readback;
+
+        if (!max5825_write_blocking(MAX5825_REG_CODEn, code) || !max5825_read_blocking(MAX5825_REG_CODEn, &readback) ||
+            readback != code) {
+            twi_recover();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint8_t max5825_probe_bitrate(void) {
+    uint8_t stored = eeprom_read_byte((uint8_t *)EEPROM_TWI_BITRATE_ADDR);
+    uint8_t check = eeprom_read_byte((uint8_t *)(EEPROM_TWI_BITRATE_ADDR + 1));
+
+    if ((uint8_t)(stored ^ check) == 0xFF && max5825_verify(stored)) {
+        return stored;
+    }
+
+    for (uint8_t i = 0; i < sizeof(max5825_bitrates); i++) {
+        uint8_t twbr = pgm_read_byte(&max5825_bitrates[i]);
+
+        if (max5825_verify(twbr)) {
+            eeprom_update_byte((uint8_t *)EEPROM_TWI_BITRATE_ADDR, twbr);
+            eeprom_update_byte((uint8_t *)(EEPROM_TWI_BITRATE_ADDR + 1), ~twbr);
+            return twbr;
+        }
+    }
+
+    // Nothing answered, keep the default and leave the EEPROM alone
+    twi_set_bitrate(TWI_TWBR(TWI_FREQ));
+    return TWI_TWBR(TWI_FREQ);
+}
+
+void max5825_init(void) {
+    max5825_command(MAX5825_REG_REF | 0b101, 0x0000);  // Setup command for reference voltage
+    max5825_shadow.batchTicket = max5825_command(MAX5825_REG_CODEn_LOADall, 0x0000);
+
+    for (uint8_t i = 0; i < MAX5825_CHANNELS; i++) {
+        max5825_shadow.committed[i] = 0x0000;
+    }
+    max5825_shadow.dirty = 0;
+}
+
+// Writes CODEn for every channel in mask from codes[] as one transfer and latches them
+// together. batch is read while the transfer is on the bus, so the previous one must
+// have completed, max5825_commit() only calls this once it has. Returns the TWI ticket.
+static uint8_t max5825_write_batch(uint8_t mask, const uint16_t *codes) {
+    uint8_t *ptr = batch;
+    uint8_t flags = 0;
+
+    for (uint8_t channel = 0; mask; channel++, mask >>= 1) {
+        if (mask & 1) {
+            ptr[0] = MAX5825_REG_CODEn | channel;
+            ptr[1] = (uint8_t)(codes[channel] >> 8);
+            ptr[2] = (uint8_t)(codes[channel] & 0xF0);
+            ptr += 3;
+        }
+    }
+
+    if (ptr == batch) return max5825_shadow.batchTicket;
+
+#ifdef MAX5825_LATCH_LDAC
+    flags = TWI_FLAG_LDAC;
+#else
+    ptr[-3] = MAX5825_REG_CODEn_LOADall | (ptr[-3] & 0x0F);  // Last code loads every channel
+#endif
+
+    max5825_shadow.batchTicket = twi_enqueue_buffer(MAX5825_ADDR, batch, ptr - batch, flags);
+    return max5825_shadow.batchTicket;
+}
+
+uint8_t max5825_commit(void) {
+    // A dropped transfer leaves the DAC behind the shadow, so every channel is sent again
+    if (max5825_shadow.busErrors != twiQueue.errors) {
+        max5825_shadow.busErrors = twiQueue.errors;
+        for (uint8_t channel = 0; channel < MAX5825_CHANNELS; channel++) {
+            if (!(max5825_shadow.dirty & (1 << channel))) {
+                max5825_shadow.pending[channel] = max5825_shadow.committed[channel];
+            }
+        }
+        max5825_shadow.dirty = 0xFF;
+    }
+
+    uint8_t dirty = max5825_shadow.dirty;
+
+    if (!dirty || !twi_complete(max5825_shadow.batchTicket)) return max5825_shadow.batchTicket;
+
+    max5825_write_batch(dirty, max5825_shadow.pending);
+
+    for (uint8_t channel = 0; dirty; channel++, dirty >>= 1) {
+        if (dirty & 1) {
+            max5825_shadow.committed[channel] = max5825_shadow.pending[channel];
+        }
+    }
+    max5825_shadow.dirty = 0;
+    return max5825_shadow.batchTicket;
+}
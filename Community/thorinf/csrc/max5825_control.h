@@ -4,34 +4,68 @@
 #include "twi_control.h"
 
 #define MAX5825_ADDR 0x20
+#define MAX5825_CHANNELS 8
 #define MAX5825_REG_REF 0x20
+#define MAX5825_REG_CODEn 0x80
+#define MAX5825_WRITE 0x00
+#define MAX5825_READ 0x01
 #define MAX5825_REG_CODEn_LOADall 0xA0
 #define MAX5825_REG_CODEn_LOADn 0xB0
 
-static inline void max5825_init(void) {
-    twi_start();
-    twi_write(MAX5825_ADDR);
-    twi_write(MAX5825_REG_REF | 0b101);  // Setup command for reference voltage
-    twi_write(0x00);
-    twi_write(0x00);
-    twi_stop();
-
-    twi_start();
-    twi_write(MAX5825_ADDR);  // Device address with write bit
-    twi_write(MAX5825_REG_CODEn_LOADall);
-    twi_write(0x00);
-    twi_write(0x00);
-    twi_stop();
+// Batched updates carry CODEn for every changed channel in one addressed transfer and
+// then latch them together, by ending on CODEn_LOADall or, when MAX5825_LATCH_LDAC is
+// defined, by pulsing LDAC (PC2) once the transfer is acknowledged.
+
+// Shadow of the DAC codes. Writes only mark a channel dirty, max5825_commit() sends
+// the newest code per channel, so the bus never carries more than one transaction
+// per channel per commit however fast the writes come in.
+typedef struct {
+    uint16_t committed[MAX5825_CHANNELS];  // Last code sent to each channel
+    uint16_t pending[MAX5825_CHANNELS];
+    uint8_t dirty;
+    uint8_t batchTicket;  // Transfer currently reading the batch buffer
+    uint16_t busErrors;   // twiQueue.errors when the shadow was last known to match the DAC
+    uint16_t coalesced;  // Pending writes replaced by a newer code before commit
+    uint16_t skipped;    // Writes dropped because the channel already holds the code
+} MAX5825_Shadow;
+
+extern MAX5825_Shadow max5825_shadow;
+
+// Queues a command with its 16 bit left-justified data word, returns the TWI ticket.
+static inline uint8_t max5825_command(uint8_t command, uint16_t value) {
+    uint8_t data[3] = {command, (uint8_t)(value >> 8), (uint8_t)(value & 0xF0)};
+    return twi_enqueue(MAX5825_ADDR, data, sizeof(data));
 }
 
+void max5825_init(void);
+
+// Finds the fastest bit rate the link holds, fastest first, by writing and reading back
+// CODE0 at each candidate. The rate stored in EEPROM is tried first and the result is
+// stored again. Runs with the blocking primitives before the queue is used and leaves
+// CODE0 at zero. Returns the TWBR selected.
+uint8_t max5825_probe_bitrate(void);
+
+// Sends every dirty channel as one batch and returns its ticket. While the previous batch
+// is still on the bus nothing is sent and the channels stay dirty, to coalesce further.
+uint8_t max5825_commit(void);
+
+static inline uint8_t max5825_pending(void) { return max5825_shadow.dirty; }
+
 static inline void max5825_write(uint8_t channel, uint16_t value) {
-    twi_start();
-    twi_write(MAX5825_ADDR);
-    twi_write(MAX5825_REG_CODEn_LOADn | (channel & 0x0F));
+    uint8_t mask = 1 << channel;
+
+    if (max5825_shadow.dirty & mask) {
+        max5825_shadow.coalesced++;
+    }
+
+    if (value == max5825_shadow.committed[channel]) {
+        max5825_shadow.dirty &= ~mask;
+        max5825_shadow.skipped++;
+        return;
+    }
 
-    twi_write((uint8_t)(value >> 4));
-    twi_write((uint8_t)((value & 0x0F) << 4));
-    twi_stop();
+    max5825_shadow.pending[channel] = value;
+    max5825_shadow.dirty |= mask;
 }
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef MIDI_BUFFER_H
+#define MIDI_BUFFER_H
+
+#include <avr/io.h>
+
+#include "midi_parser.h"
+
+// Single-producer/single-consumer ring of parsed MIDI messages.
+// The producer is the USART ISR, the consumer is whichever context is draining.
+// Indices run freely and are masked on access, so SIZE must be a power of two
+// no larger than 128 for the 8-bit difference (head - tail) to stay valid.
+#define MIDI_BUFFER_SIZE 16
+#define MIDI_BUFFER_MASK (MIDI_BUFFER_SIZE - 1)
+
+#if (MIDI_BUFFER_SIZE & MIDI_BUFFER_MASK) || (MIDI_BUFFER_SIZE > 128)
+#error "MIDI_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+#define MIDI_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+typedef struct {
+    MIDI_Message messages[MIDI_BUFFER_SIZE];
+    volatile uint8_t head;        // Only written by the producer
+    volatile uint8_t tail;        // Only written by the consumer
+    volatile uint8_t highWater;   // Most messages ever waiting at once
+    volatile uint16_t overflows;  // Messages dropped because the ring was full
+} MIDI_Buffer;
+
+static inline uint8_t midi_buffer_push(MIDI_Buffer *buffer, uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t head = buffer->head;
+    uint8_t used = head - buffer->tail;
+
+    if (used >= MIDI_BUFFER_SIZE) {
+        if (buffer->overflows != 0xFFFF) buffer->overflows++;
+        return 0;
+    }
+
+    MIDI_Message *msg = &buffer->messages[head & MIDI_BUFFER_MASK];
+    msg->status = status;
+    msg->data1 = data1;
+    msg->data2 = data2;
+
+    MIDI_BARRIER();  // Payload must be in place before the message is published
+    buffer->head = head + 1;
+
+    if (++used > buffer->highWater) buffer->highWater = used;
+    return 1;
+}
+
+static inline uint8_t midi_buffer_pop(MIDI_Buffer *buffer, MIDI_Message *msg) {
+    uint8_t tail = buffer->tail;
+
+    if (tail == buffer->head) return 0;
+
+    MIDI_BARRIER();
+    *msg = buffer->messages[tail & MIDI_BUFFER_MASK];
+    MIDI_BARRIER();  // Slot must be copied out before it is handed back
+
+    buffer->tail = tail + 1;
+    return 1;
+}
+
+static inline uint8_t midi_buffer_count(MIDI_Buffer *buffer) { return (uint8_t)(buffer->head - buffer->tail); }
+
+// Consumer side only, discards everything currently waiting.
+static inline void midi_buffer_flush(MIDI_Buffer *buffer) { buffer->tail = buffer->head; }
+
+#endif
@@ -0,0 +1,75 @@
+#include "midi_parser.h"
+
+#include <avr/pgmspace.h>
+
+// Data bytes following each status, indexed by midi_length_index()
+static const uint8_t midi_data_length[16] PROGMEM = {
+    2, 2, 2, 2, 1, 1, 2, MIDI_LENGTH_IGNORE,  // 0x8n - 0xEn
+    MIDI_LENGTH_IGNORE,                       // 0xF0 SysEx, data is skipped up to 0xF7
+    1,                                        // 0xF1 MTC quarter frame
+    2,                                        // 0xF2 Song Position Pointer
+    1,                                        // 0xF3 Song Select
+    MIDI_LENGTH_IGNORE,                       // 0xF4 Undefined
+    MIDI_LENGTH_IGNORE,                       // 0xF5 Undefined
+    0,                                        // 0xF6 Tune Request
+    MIDI_LENGTH_IGNORE                        // 0xF7 End of SysEx
+};
+
+static inline uint8_t midi_length_index(uint8_t status) {
+    return (status < 0xF0) ? ((status >> 4) & 0x07) : (8 | (status & 0x07));
+}
+
+static inline uint8_t midi_emit(MIDI_Parser *parser, MIDI_Message *msg, uint8_t data1, uint8_t data2) {
+    uint8_t status = parser->status;
+
+    if (IS_NOTE_ON(status) && data2 == 0) {
+        status &= 0xEF;  // Note On velocity 0 is a Note Off
+    }
+
+    msg->status = status;
+    msg->data1 = data1;
+    msg->data2 = data2;
+
+    parser->received = 0;
+    if (parser->status >= 0xF0) {
+        // System Common messages never run, the next data byte needs a fresh status
+        parser->status = 0;
+        parser->expected = MIDI_LENGTH_IGNORE;
+    }
+    return 1;
+}
+
+void midi_parser_init(MIDI_Parser *parser) {
+    parser->status = 0;
+    parser->expected = MIDI_LENGTH_IGNORE;
+    parser->received = 0;
+    parser->data1 = 0;
+}
+
+uint8_t midi_parse(MIDI_Parser *parser, uint8_t byte, MIDI_Message *msg) {
+    if (IS_REALTIME(byte)) {
+        msg->status = byte;
+        msg->data1 = 0;
+        msg->data2 = 0;
+        return 1;
+    }
+
+    if (byte & 0x80) {
+        parser->status = byte;
+        parser->expected = pgm_read_byte(&midi_data_length[midi_length_index(byte)]);
+        parser->received = 0;
+
+        return (parser->expected == 0) ? midi_emit(parser, msg, 0, 0) : 0;
+    }
+
+    if (parser->expected == MIDI_LENGTH_IGNORE) {
+        return 0;
+    }
+
+    if (++parser->received < parser->expected) {
+        parser->data1 = byte;
+        return 0;
+    }
+
+    return (parser->expected == 1) ? midi_emit(parser, msg, byte, 0) : midi_emit(parser, msg, parser->data1, byte);
+}
@@ -0,0 +1,50 @@
+#ifndef MIDI_PARSER_H
+#define MIDI_PARSER_H
+
+#include <avr/io.h>
+
+#define IS_NOTE_ON(command) (((command) & 0xF0) == 0x90)
+#define IS_NOTE_OFF(command) (((command) & 0xF0) == 0x80)
+#define IS_CONTROL_CHANGE(command) (((command) & 0xF0) == 0xB0)
+#define IS_PROGRAM_CHANGE(command) (((command) & 0xF0) == 0xC0)
+#define IS_CHANNEL_MESSAGE(command) ((command) >= 0x80 && (command) < 0xF0)
+#define IS_REALTIME(command) ((command) >= 0xF8)
+
+// System messages
+#define MIDI_SYSEX_START 0xF0
+#define MIDI_TIME_CODE 0xF1
+#define MIDI_SONG_POSITION 0xF2
+#define MIDI_SONG_SELECT 0xF3
+#define MIDI_TUNE_REQUEST 0xF6
+#define MIDI_SYSEX_END 0xF7
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} MIDI_Message;
+
+typedef struct {
+    uint8_t status;    // Status being assembled, kept between channel messages for running status
+    uint8_t expected;  // Data bytes the status needs, MIDI_LENGTH_IGNORE while discarding
+    uint8_t received;
+    uint8_t data1;
+} MIDI_Parser;
+
+#define MIDI_LENGTH_IGNORE 0xFF
+
+void midi_parser_init(MIDI_Parser *parser);
+
+// Drops any partly received message, running status is kept.
+static inline void midi_parser_abort(MIDI_Parser *parser) { parser->received = 0; }
+
+// Feeds one byte from the wire, returns 1 when msg holds a complete message.
+// Real-time bytes are returned straight away and leave the message in progress untouched.
+// A Note On with zero velocity is returned as a Note Off.
+uint8_t midi_parse(MIDI_Parser *parser, uint8_t byte, MIDI_Message *msg);
+
+#endif
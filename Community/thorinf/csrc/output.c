@@ -0,0 +1,97 @@
+#include "output.h"
+
+#include "pin_control.h"
+#include "pulse.h"
+
+OutputFrame outputFrame;
+OutputLatency outputLatency;
+uint8_t output_settle = OUTPUT_SETTLE_TICKS;
+
+static uint8_t heldRises;  // Rising gates waiting for their CV
+static uint8_t heldFalls;  // Held gates whose note ended meanwhile
+static uint8_t heldSent;   // Held gates whose code is on the bus under heldTicket[]
+static uint8_t heldTicket[NUM_GATES];
+static uint16_t heldStamp[NUM_GATES];
+
+static void output_measure(uint16_t stamp) {
+    uint16_t latency = (uint16_t)(TCNT1 - stamp) + output_settle;
+
+    outputLatency.last = latency;
+    if (latency > outputLatency.max) outputLatency.max = latency;
+}
+
+static void output_release(void) {
+    uint8_t ready = 0;
+    uint16_t stamp = 0;
+
+    for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+        uint8_t mask = 1 << gate;
+
+        if (!(heldRises & mask)) continue;
+        if (max5825_shadow.dirty & mask) {
+            heldSent &= ~mask;  // Not sent yet, or sent again after a bus error
+            continue;
+        }
+
+        if (!(heldSent & mask)) {
+            heldTicket[gate] = max5825_shadow.batchTicket;  // Newest batch carries the code
+            heldSent |= mask;
+        }
+        if (twi_complete(heldTicket[gate])) {
+            ready |= mask;
+            stamp = heldStamp[gate];
+        }
+    }
+
+    if (!ready) return;
+
+    pulse_apply(ready & ~heldFalls, ready, ready & heldFalls, output_settle);
+    output_measure(stamp);
+
+    heldRises &= ~ready;
+    heldFalls &= ~ready;
+    heldSent &= ~ready;
+}
+
+void output_begin(uint16_t stamp) {
+    outputFrame.gates = gate_read();
+    outputFrame.rises = 0;
+    outputFrame.falls = 0;
+    outputFrame.cvs = 0;
+    outputFrame.stamp = stamp;
+}
+
+void output_commit(void) {
+    uint8_t rises = outputFrame.rises;
+    uint8_t falls = outputFrame.falls;
+
+    max5825_commit();
+
+#ifndef OUTPUT_GATE_FIRST
+    uint8_t touched = (rises | falls) & heldRises;
+    uint8_t hold = (rises & outputFrame.cvs) | touched;
+
+    if (hold) {
+        // Events on a gate that is already held join it, the final state decides
+        heldFalls = (heldFalls & ~touched) | (hold & ~outputFrame.gates);
+        heldSent &= ~(hold & outputFrame.cvs);
+        for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+            if ((rises & outputFrame.cvs) & (1 << gate)) heldStamp[gate] = outputFrame.stamp;
+        }
+        heldRises |= hold;
+        rises &= ~hold;
+        falls &= ~hold;
+    }
+#endif
+
+    if (rises | falls) {
+        pulse_apply(outputFrame.gates, rises, falls, 0);
+        if (rises) output_measure(outputFrame.stamp);
+    }
+
+#ifndef OUTPUT_GATE_FIRST
+    output_release();
+#endif
+}
+
+uint8_t output_pending(void) { return max5825_pending() || heldRises; }
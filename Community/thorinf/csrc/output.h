@@ -0,0 +1,73 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <avr/io.h>
+
+#include "hardware_config.h"
+#include "max5825_control.h"
+
+// Rising gates wait for the CV written with them: the edge is handed to the pulse engine
+// only once the DAC has acknowledged the code, and output_settle Timer1 counts (16 us)
+// later. Gate offs and edges without a CV change go out immediately. Defining
+// OUTPUT_GATE_FIRST restores the old order, gate first and CV after, for comparison.
+//
+// MIDI byte to gate edge, at 400 kHz with one channel changing, estimated from the bus
+// timing rather than measured:
+//   gate first    ~40 us, the edge leads the DAC by ~110 us
+//   gate after CV ~150 us + settle, the edge trails the DAC by the settle time
+// outputLatency measures the figure on the running unit, in Timer1 counts, and is read
+// out through the status snapshot, see status.h.
+#ifndef OUTPUT_SETTLE_TICKS
+#define OUTPUT_SETTLE_TICKS 0
+#endif
+
+// Next state of every output, built up while a burst of messages is handled
+// and then applied in one step by output_commit(). CV codes are staged in the
+// MAX5825 shadow registers, gate edges go through the pulse engine.
+typedef struct {
+    uint8_t gates;   // Bit n is gate n, as the last message left it
+    uint8_t rises;   // Gates that saw a note on during the frame
+    uint8_t falls;   // Gates that saw a note off during the frame
+    uint8_t cvs;     // DAC channels written during the frame
+    uint16_t stamp;  // Timer1 when the newest message of the frame arrived
+} OutputFrame;
+
+typedef struct {
+    uint16_t last;  // Timer1 counts from the MIDI message to its rising edge
+    uint16_t max;
+} OutputLatency;
+
+extern OutputFrame outputFrame;
+extern OutputLatency outputLatency;
+extern uint8_t output_settle;
+
+// Starts a frame from the gates as they are now, stamp is when its newest message arrived.
+void output_begin(uint16_t stamp);
+
+// Sends every DAC channel touched since output_begin(), applies gate offs and the rises
+// that carry no CV, and releases held rises whose codes have been acknowledged.
+// Also called with an empty frame to keep held rises moving.
+void output_commit(void);
+
+// True while DAC channels or rising gates are still waiting to go out.
+uint8_t output_pending(void);
+
+static inline void output_gate(uint8_t gateIndex, uint8_t state) {
+    uint8_t mask = 1 << gateIndex;
+
+    if (state) {
+        outputFrame.gates |= mask;
+        outputFrame.rises |= mask;
+    } else {
+        outputFrame.gates &= ~mask;
+        outputFrame.falls |= mask;
+    }
+}
+
+// Later writes to a channel in the same frame replace earlier ones.
+static inline void output_cv(uint8_t channel, uint16_t value) {
+    outputFrame.cvs |= 1 << channel;
+    max5825_write(channel, value);
+}
+
+#endif
@@ -1,11 +1,23 @@
 #include "pin_control.h"
 
 #include <avr/eeprom.h>
+#include <util/delay.h>
+
+volatile uint8_t gate_state = 0;
+uint8_t gate_invert = 0;
 
 void pin_initialize(void) {
     GATE_DDR_B |= (1 << GATE_PIN_0);  // Set PB0 as output
     GATE_DDR_D |= 0xFE;               // Set PD1 to PD7 as outputs
 
+    // Newer hardware ties the revision pin to ground, older boards leave it
+    // floating and have inverting gate outputs (same check as the stock firmware)
+    HW_REVISION_PORT |= (1 << HW_REVISION_PIN);
+    HW_REVISION_DDR &= ~(1 << HW_REVISION_PIN);
+    _delay_ms(1);
+    gate_invert = (HW_REVISION_PIN_REG & (1 << HW_REVISION_PIN)) ? 0xFF : 0x00;
+    gate_write(0x00);
+
     DDRC |= (1 << LED_PIN);
     led_off();
 
@@ -21,16 +33,3 @@ void pin_initialize(void) {
     LDAC_PORT |= (1 << LDAC_PIN);
     CLR_PORT |= (1 << CLR_PIN);
 }
-
-void gate_set_multiple(uint8_t gateMask, uint8_t state) {
-    uint8_t portBMask = (gateMask & 0x01) << GATE_PIN_0;
-    uint8_t portDMask = ((gateMask >> 1) & 0x7F) << GATE_PIN_1;
-
-    if (state) {
-        GATE_PORT_B |= portBMask;
-        GATE_PORT_D |= portDMask;
-    } else {
-        GATE_PORT_B &= ~portBMask;
-        GATE_PORT_D &= ~portDMask;
-    }
-}
\ No newline at end of file
@@ -1,8 +1,15 @@
 #ifndef PIN_CONTROL_H
 #define PIN_CONTROL_H
 
+#include <util/atomic.h>
+
 #include "hardware_config.h"
 
+// Gates are modelled as one byte, bit n is gate n. Older hardware drives the jacks
+// through an inverter, which gate_invert folds back in with a single XOR.
+extern volatile uint8_t gate_state;
+extern uint8_t gate_invert;
+
 void pin_initialize(void);
 
 static inline uint8_t read_button(void) { return BUTTON_PIN_REG & (1 << BUTTON_PIN); }
@@ -11,24 +18,27 @@ static inline void led_on(void) { LED_PORT &= ~(1 << LED_PIN); }
 
 static inline void led_off(void) { LED_PORT |= (1 << LED_PIN); }
 
-static inline void gate_set(uint8_t gateIndex, uint8_t state) {
-    static const uint8_t gatePortMasks[NUM_GATES] = {
-        (1 << GATE_PIN_0),       (1 << (GATE_PIN_1 + 0)), (1 << (GATE_PIN_1 + 1)), (1 << (GATE_PIN_1 + 2)),
-        (1 << (GATE_PIN_1 + 3)), (1 << (GATE_PIN_1 + 4)), (1 << (GATE_PIN_1 + 5)), (1 << (GATE_PIN_1 + 6))};
-
-    static volatile uint8_t *const gatePorts[NUM_GATES] = {&GATE_PORT_B, &GATE_PORT_D, &GATE_PORT_D, &GATE_PORT_D,
-                                                           &GATE_PORT_D, &GATE_PORT_D, &GATE_PORT_D, &GATE_PORT_D};
+// Gate 0 is on PB0 and gates 1-7 are on PD1-PD7, so bit n of the state is already
+// in place for its port and the whole frame is two back to back stores.
+static inline void gate_write(uint8_t gates) {
+    uint8_t level = gates ^ gate_invert;
 
-    volatile uint8_t *port = gatePorts[gateIndex];
-    uint8_t mask = gatePortMasks[gateIndex];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t portB = (GATE_PORT_B & ~(1 << GATE_PIN_0)) | ((level & 0x01) << GATE_PIN_0);
+        uint8_t portD = (GATE_PORT_D & 0x01) | (level & 0xFE);
 
-    if (state) {
-        *port |= mask;
-    } else {
-        *port &= ~mask;
+        GATE_PORT_B = portB;
+        GATE_PORT_D = portD;
+        gate_state = gates;
     }
 }
 
-void gate_set_multiple(uint8_t gateMask, uint8_t state);
+static inline uint8_t gate_read(void) { return gate_state; }
+
+static inline void gate_set_multiple(uint8_t gateMask, uint8_t state) {
+    gate_write(state ? (gate_state | gateMask) : (gate_state & ~gateMask));
+}
+
+static inline void gate_set(uint8_t gateIndex, uint8_t state) { gate_set_multiple(1 << gateIndex, state); }
 
-#endif
\ No newline at end of file
+#endif
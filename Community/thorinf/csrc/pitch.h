@@ -2,6 +2,7 @@
 #define PITCH_LOOKUP_H
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #define PITCH_SIZE 61
 
@@ -19,8 +20,8 @@
 //     C10, Cs10, D10, Ds10, E10, F10, Fs10, G10
 // };
 
-// Pitch lookup array definition
-static const uint16_t pitch_lookup[61] = {
+// Pitch lookup array definition, in flash, read with pgm_read_word()
+static const uint16_t pitch_lookup[61] PROGMEM = {
     0x0000, 0x0440, 0x0880, 0x0CD0, 0x1110, 0x1550, 0x19A0, 0x1DE0, 0x2220, 0x2660, 0x2AA0, 0x2EF0,  // C-2
     0x3330, 0x3770, 0x3BC0, 0x4000, 0x4440, 0x4880, 0x4CC0, 0x5110, 0x5550, 0x5990, 0x5DE0, 0x6220,  // C-1
     0x6660, 0x6AA0, 0x6EE0, 0x7330, 0x7770, 0x7BB0, 0x8000, 0x8440, 0x8880, 0x8CC0, 0x9100, 0x9550,  // C0
@@ -0,0 +1,238 @@
+#include "pulse.h"
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "pin_control.h"
+
+typedef struct {
+    uint16_t deadline;
+    uint8_t action;
+    uint8_t fallAfterRise;  // Note off arrived while the rise was still waiting
+} PulseState;
+
+GateTiming gate_timing[NUM_GATES];
+
+static PulseState pulses[NUM_GATES];
+static uint8_t queue[NUM_GATES];  // Gates with a pending event, soonest first
+static uint8_t queued;
+
+static inline int16_t pulse_until(uint16_t deadline) { return (int16_t)(deadline - TCNT1); }
+
+static void pulse_unschedule(uint8_t gate) {
+    uint8_t i = 0;
+
+    pulses[gate].action = PULSE_NONE;
+    while (i < queued && queue[i] != gate) i++;
+    if (i == queued) return;
+
+    queued--;
+    for (; i < queued; i++) {
+        queue[i] = queue[i + 1];
+    }
+}
+
+static void pulse_schedule(uint8_t gate, uint8_t action, uint16_t deadline) {
+    int16_t until = pulse_until(deadline);
+    uint8_t i;
+
+    pulse_unschedule(gate);
+    pulses[gate].action = action;
+    pulses[gate].deadline = deadline;
+
+    for (i = queued; i > 0 && pulse_until(pulses[queue[i - 1]].deadline) > until; i--) {
+        queue[i] = queue[i - 1];
+    }
+    queue[i] = gate;
+    queued++;
+}
+
+// Runs every event that is due and arms compare A for the next, interrupts must be off.
+static void pulse_service(void) {
+    uint8_t state = gate_state;
+
+    while (queued) {
+        uint8_t gate = queue[0];
+        PulseState *p = &pulses[gate];
+        GateTiming *t = &gate_timing[gate];
+        uint16_t at = p->deadline;
+        uint8_t mask = 1 << gate;
+
+        if (pulse_until(at) > 0) {
+            OCR1A = at;
+            TIFR = (1 << OCF1A);
+            TIMSK |= (1 << OCIE1A);
+            if (pulse_until(at) > 0) break;
+            continue;  // Passed while arming, the compare would not fire until the wrap
+        }
+
+        uint8_t action = p->action;
+        pulse_unschedule(gate);
+
+        switch (action) {
+            case PULSE_RISE:
+                state |= mask;
+                if (t->triggerLength) {
+                    pulse_schedule(gate, PULSE_FALL, at + PULSE_MS(t->triggerLength));
+                } else if (p->fallAfterRise) {
+                    pulse_schedule(gate, PULSE_FALL, at + PULSE_MS(t->minLength ? t->minLength : 1));
+                } else if (t->minLength) {
+                    pulse_schedule(gate, PULSE_HOLD_END, at + PULSE_MS(t->minLength));
+                }
+                p->fallAfterRise = 0;
+                break;
+
+            case PULSE_FALL:
+                state &= ~mask;
+                if (t->retriggerGap) {
+                    pulse_schedule(gate, PULSE_GAP_END, at + PULSE_MS(t->retriggerGap));
+                }
+                break;
+
+            default:  // Hold or gap over, nothing to drive
+                break;
+        }
+    }
+
+    if (!queued) {
+        TIMSK &= ~(1 << OCIE1A);
+    }
+    if (state != gate_state) {
+        gate_write(state);
+    }
+}
+
+static uint8_t pulse_note_on(uint8_t gate, uint8_t state, uint16_t now, uint8_t delay) {
+    PulseState *p = &pulses[gate];
+    GateTiming *t = &gate_timing[gate];
+    uint8_t mask = 1 << gate;
+
+    p->fallAfterRise = 0;
+
+    if (p->action == PULSE_RISE) {
+        return state;  // Already on its way up
+    }
+    if (p->action == PULSE_GAP_END) {
+        uint16_t at = p->deadline;
+        if ((int16_t)(now + delay - at) > 0) at = now + delay;
+        pulse_schedule(gate, PULSE_RISE, at);
+        return state;
+    }
+
+    if (state & mask) {
+        if (t->retriggerGap) {
+            // Retrigger, drop now and come back up once the gap has passed
+            uint16_t gap = PULSE_MS(t->retriggerGap);
+            pulse_schedule(gate, PULSE_RISE, now + (gap > delay ? gap : delay));
+            return state & ~mask;
+        }
+        if (t->triggerLength) {
+            pulse_schedule(gate, PULSE_FALL, now + PULSE_MS(t->triggerLength));
+        } else if (t->minLength) {
+            pulse_schedule(gate, PULSE_HOLD_END, now + PULSE_MS(t->minLength));
+        } else {
+            pulse_unschedule(gate);
+        }
+        return state;
+    }
+
+    if (delay) {
+        pulse_schedule(gate, PULSE_RISE, now + delay);
+        return state;
+    }
+    if (t->triggerLength) {
+        pulse_schedule(gate, PULSE_FALL, now + PULSE_MS(t->triggerLength));
+    } else if (t->minLength) {
+        pulse_schedule(gate, PULSE_HOLD_END, now + PULSE_MS(t->minLength));
+    }
+    return state | mask;
+}
+
+static uint8_t pulse_note_off(uint8_t gate, uint8_t state, uint16_t now) {
+    PulseState *p = &pulses[gate];
+    GateTiming *t = &gate_timing[gate];
+    uint8_t mask = 1 << gate;
+
+    if (t->triggerLength) {
+        return state;  // Triggers run their own length
+    }
+    if (p->action == PULSE_RISE) {
+        p->fallAfterRise = 1;
+        return state;
+    }
+    if (!(state & mask)) {
+        return state;
+    }
+    if (p->action == PULSE_HOLD_END) {
+        pulse_schedule(gate, PULSE_FALL, p->deadline);
+        return state;
+    }
+
+    pulse_unschedule(gate);
+    if (t->retriggerGap) {
+        pulse_schedule(gate, PULSE_GAP_END, now + PULSE_MS(t->retriggerGap));
+    }
+    return state & ~mask;
+}
+
+void pulse_init(void) {
+    TCCR1A = 0;
+    TCCR1B = (1 << CS12);  // Normal mode, F_CPU / 256
+    pulse_clear();
+}
+
+void pulse_clear(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+            pulses[gate].action = PULSE_NONE;
+            pulses[gate].fallAfterRise = 0;
+        }
+        queued = 0;
+        TIMSK &= ~(1 << OCIE1A);
+    }
+}
+
+void pulse_apply(uint8_t gates, uint8_t rises, uint8_t falls, uint8_t delay) {
+    uint8_t events = rises | falls;
+
+    if (!events) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint16_t now = TCNT1;
+        uint8_t state = gate_state;
+
+        for (uint8_t gate = 0; events; gate++, events >>= 1, rises >>= 1, falls >>= 1, gates >>= 1) {
+            if (!(events & 1)) continue;
+
+            // Replay the frame in the order that leaves the gate where the messages did
+            if (gates & 1) {
+                if (falls & 1) state = pulse_note_off(gate, state, now);
+                state = pulse_note_on(gate, state, now, delay);
+            } else {
+                if (rises & 1) state = pulse_note_on(gate, state, now, delay);
+                state = pulse_note_off(gate, state, now);
+            }
+        }
+
+        gate_write(state);
+        pulse_service();
+    }
+}
+
+void pulse_trigger(uint8_t gates, uint16_t length) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint16_t now = TCNT1;
+
+        for (uint8_t gate = 0; gate < NUM_GATES; gate++) {
+            if (!(gates & (1 << gate))) continue;
+
+            uint8_t ms = gate_timing[gate].triggerLength;
+            pulse_schedule(gate, PULSE_FALL, now + (ms ? PULSE_MS(ms) : length));
+        }
+
+        gate_write(gate_state | gates);
+        pulse_service();
+    }
+}
+
+ISR(TIMER1_COMPA_vect) { pulse_service(); }
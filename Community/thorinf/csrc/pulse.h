@@ -0,0 +1,44 @@
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <avr/io.h>
+
+#include "hardware_config.h"
+
+// Gate timing engine. Timer1 runs freely at F_CPU / 256 (16 us per count) and its
+// compare A interrupt works through a small deadline list, at most one pending event
+// per gate, kept sorted so the ISR only ever looks at the head.
+#define PULSE_TICKS_PER_2MS 125
+#define PULSE_MS(ms) ((uint16_t)(ms) * PULSE_TICKS_PER_2MS / 2)
+
+// Pending event per gate
+#define PULSE_NONE 0
+#define PULSE_RISE 1      // Gate goes high
+#define PULSE_FALL 2      // Gate goes low
+#define PULSE_HOLD_END 3  // Minimum length reached, a note off may now drop the gate
+#define PULSE_GAP_END 4   // Retrigger gap over, a note on may now raise the gate
+
+// Milliseconds, 0 disables each feature
+typedef struct {
+    uint8_t triggerLength;  // Fixed pulse on every note on, note off is ignored
+    uint8_t minLength;      // A note off never ends the gate sooner than this
+    uint8_t retriggerGap;   // Low time forced before the gate rises again
+} GateTiming;
+
+extern GateTiming gate_timing[NUM_GATES];
+
+void pulse_init(void);
+
+// Cancels every pending event, for when the gates are taken over by the menu.
+void pulse_clear(void);
+
+// Applies a frame: gates is the final state the messages asked for, rises and falls
+// the gates that saw a note on or a note off during the frame. Rising edges of gates
+// that are low are postponed by delay Timer1 counts.
+void pulse_apply(uint8_t gates, uint8_t rises, uint8_t falls, uint8_t delay);
+
+// Raises the gates now for their trigger length, or length Timer1 counts where they
+// have none. Safe to call from an ISR.
+void pulse_trigger(uint8_t gates, uint16_t length);
+
+#endif
@@ -1,5 +1,27 @@
 #include "random.h"
 
+#include <avr/pgmspace.h>
+
+// Column j of each matrix is the state reached from bit j alone
+static const uint16_t lfsr_jump_table[LFSR_JUMP_POWERS][16] PROGMEM = {
+    {0x8000, 0x0001, 0x8002, 0x8004, 0x0008, 0x8010, 0x0020, 0x0040, 0x0080, 0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000},  // A^1
+    {0x4000, 0x8000, 0x4001, 0xC002, 0x8004, 0x4008, 0x8010, 0x0020, 0x0040, 0x0080, 0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000},  // A^2
+    {0x1000, 0x2000, 0x5000, 0xB000, 0x6001, 0xD002, 0xA004, 0x4008, 0x8010, 0x0020, 0x0040, 0x0080, 0x0100, 0x0200, 0x0400, 0x0800},  // A^4
+    {0x0100, 0x0200, 0x0500, 0x0B00, 0x1600, 0x2D00, 0x5A00, 0xB400, 0x6801, 0xD002, 0xA004, 0x4008, 0x8010, 0x0020, 0x0040, 0x0080},  // A^8
+    {0x6801, 0xD002, 0xC805, 0xF80B, 0xF016, 0x882D, 0x105A, 0x20B4, 0x4168, 0x82D0, 0x05A0, 0x0B40, 0x1680, 0x2D00, 0x5A00, 0xB400},  // A^16
+    {0x1441, 0x2882, 0x4544, 0x9EC8, 0x3D91, 0x6F62, 0xDEC5, 0xBD8A, 0x7B14, 0xF628, 0xEC51, 0xD8A2, 0xB144, 0x6288, 0xC510, 0x8A20},  // A^32
+    {0x9791, 0x2F22, 0xC9D4, 0x0438, 0x0871, 0x8772, 0x0EE5, 0x1DCB, 0x3B97, 0x772F, 0xEE5E, 0xDCBC, 0xB979, 0x72F2, 0xE5E4, 0xCBC8},  // A^64
+    {0x527C, 0xA4F8, 0x1B8C, 0x6565, 0xCACB, 0xC7EA, 0x8FD4, 0x1FA9, 0x3F52, 0x7EA4, 0xFD49, 0xFA93, 0xF527, 0xEA4F, 0xD49F, 0xA93E},  // A^128
+    {0xA300, 0x4601, 0x2F02, 0xFD05, 0xFA0A, 0x5714, 0xAE28, 0x5C51, 0xB8A3, 0x7146, 0xE28C, 0xC518, 0x8A30, 0x1460, 0x28C0, 0x5180},  // A^256
+    {0x8C05, 0x180A, 0xBC10, 0xF425, 0xE84A, 0x5C91, 0xB923, 0x7246, 0xE48C, 0xC918, 0x9230, 0x2460, 0x48C0, 0x9180, 0x2301, 0x4602},  // A^512
+    {0xC047, 0x808F, 0xC158, 0x42F7, 0x85EF, 0xCB98, 0x9730, 0x2E60, 0x5CC0, 0xB980, 0x7301, 0xE602, 0xCC04, 0x9808, 0x3011, 0x6023},  // A^1024
+    {0x4692, 0x8D24, 0x5CDA, 0xFF26, 0xFE4D, 0xBA08, 0x7411, 0xE823, 0xD046, 0xA08D, 0x411A, 0x8234, 0x0469, 0x08D2, 0x11A4, 0x2349},  // A^2048
+    {0x6B79, 0xD6F3, 0xC69E, 0xE645, 0xCC8A, 0xF26D, 0xE4DA, 0xC9B5, 0x936B, 0x26D6, 0x4DAD, 0x9B5B, 0x36B7, 0x6D6F, 0xDADE, 0xB5BC},  // A^4096
+    {0xCE56, 0x9CAC, 0xF70E, 0x204B, 0x4097, 0x4F79, 0x9EF3, 0x3DE7, 0x7BCE, 0xF79C, 0xEF39, 0xDE72, 0xBCE5, 0x79CA, 0xF395, 0xE72B},  // A^8192
+    {0x67AF, 0xCF5E, 0xF913, 0x9588, 0x2B11, 0x318C, 0x6319, 0xC633, 0x8C67, 0x18CF, 0x319E, 0x633D, 0xC67A, 0x8CF5, 0x19EB, 0x33D7},  // A^16384
+    {0x03FD, 0x07FA, 0x0C09, 0x1BEF, 0x37DE, 0x6C40, 0xD880, 0xB101, 0x6203, 0xC407, 0x880F, 0x101F, 0x203F, 0x407F, 0x80FF, 0x01FE}  // A^32768
+};
+
 inline uint16_t updateLfsr(uint16_t *lfsr) {
     uint16_t bit = ((*lfsr >> 0) ^ (*lfsr >> 2) ^ (*lfsr >> 3) ^ (*lfsr >> 5)) & 1;
     *lfsr = (*lfsr >> 1) | (bit << 15);
@@ -10,4 +32,43 @@ inline uint16_t updateLfsrAlt(uint16_t *lfsr) {
     uint16_t bit = ((*lfsr >> 1) ^ (*lfsr >> 3) ^ (*lfsr >> 4) ^ (*lfsr >> 8)) & 1;
     *lfsr = (*lfsr >> 1) | (bit << 15);
     return *lfsr;
-}
\ No newline at end of file
+}
+
+uint16_t lfsrJump(uint16_t lfsr, uint16_t steps) {
+    for (uint8_t power = 0; steps; power++, steps >>= 1) {
+        if (!(steps & 1)) continue;
+
+        const uint16_t *columns = lfsr_jump_table[power];
+        uint16_t next = 0;
+
+        for (uint8_t bit = 0; lfsr; bit++, lfsr >>= 1) {
+            if (lfsr & 1) next ^= pgm_read_word(&columns[bit]);
+        }
+        lfsr = next;
+    }
+    return lfsr;
+}
+
+// The feedback of eight consecutive shifts reads bits 0..12 of the register, none of
+// which those shifts write, so a whole byte of feedback is one word expression.
+uint16_t stepLfsr(uint16_t *lfsr) {
+    uint16_t s = *lfsr;
+
+    s = (s >> 8) | ((s ^ (s >> 2) ^ (s >> 3) ^ (s >> 5)) << 8);
+    s = (s >> 8) | ((s ^ (s >> 2) ^ (s >> 3) ^ (s >> 5)) << 8);
+
+    *lfsr = s;
+    return s;
+}
+
+uint16_t lfsrSeek(uint16_t lfsr, uint16_t steps) {
+    uint32_t shifts = (uint32_t)steps * LFSR_STEP_SHIFTS;
+
+    // Shift counts only matter modulo the period, and 65536 is 1 modulo 65535
+    shifts = (shifts & 0xFFFF) + (shifts >> 16);
+    if (shifts >= LFSR_PERIOD) shifts -= LFSR_PERIOD;
+
+    return lfsrJump(lfsr, (uint16_t)shifts);
+}
+
+uint16_t splitLfsr(uint16_t root, uint8_t stream) { return lfsrJump(root, (uint16_t)stream * LFSR_STREAM_SHIFTS); }
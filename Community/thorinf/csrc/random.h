@@ -3,7 +3,43 @@
 
 #include <avr/io.h>
 
+// updateLfsr() is linear over GF(2), so n shifts are one 16x16 bit matrix A^n.
+// lfsr_jump_table holds A^(2^k) (generated by Scripts/lfsr_jump.py) and lfsrJump()
+// applies one matrix per set bit of the shift count, at most 16 matrix-vector
+// products (~2k cycles) for any jump. The register is maximal length, period 65535.
+#define LFSR_JUMP_POWERS 16
+#define LFSR_PERIOD 65535U
+
+// Sequence steps are stepLfsr() calls, 16 shifts each, so every step is a fresh word
+// instead of the last one moved along a bit. Estimated from the instruction count, not
+// measured: ~60 cycles per call against ~25 for a single updateLfsr() shift.
+// Scripts/prng_quality.py compares the quality of the two on the host.
+#define LFSR_STEP_SHIFTS 16
+
+// splitLfsr() streams start this many shifts apart, 511 steps each before one runs
+// into the next.
+#define LFSR_STREAM_SHIFTS 8191U
+
+// Loop of a random step sequence. Reset starts it start steps after the seed and it
+// returns there every length steps; length 0 runs free.
+typedef struct {
+    uint8_t length;
+    uint8_t start;
+} LfsrLoop;
+
 uint16_t updateLfsr(uint16_t *lfsr);
 uint16_t updateLfsrAlt(uint16_t *lfsr);
 
-#endif
\ No newline at end of file
+// Returns the state updateLfsr() reaches from lfsr after steps calls.
+uint16_t lfsrJump(uint16_t lfsr, uint16_t steps);
+
+// Moves the register on LFSR_STEP_SHIFTS shifts and returns it.
+uint16_t stepLfsr(uint16_t *lfsr);
+
+// Returns the state stepLfsr() reaches from lfsr after steps calls.
+uint16_t lfsrSeek(uint16_t lfsr, uint16_t steps);
+
+// Seed of stream number stream out of one root seed, for independent per-gate sequences.
+uint16_t splitLfsr(uint16_t root, uint8_t stream);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <avr/io.h>
+
+#include "hardware_config.h"
+
+// Snapshot of the diagnostic counters, written to EEPROM_STATUS_ADDR on request by
+// SysEx, since the module has no MIDI output to answer with. Read it back with an ISP
+// programmer, e.g. avrdude -U eeprom:r:eeprom.hex:i. Multi-byte fields are little
+// endian. Fields are only ever appended, so a reader goes by STATUS_VERSION and ignores
+// what it does not know. The record must stay within the 48 bytes below EEPROM_CONFIG_ADDR.
+#define STATUS_MAGIC 0x53
+#define STATUS_VERSION 3
+
+// Flags
+#define STATUS_GATE_FIRST 0x01  // Built with OUTPUT_GATE_FIRST
+
+typedef struct {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t uartOverruns;     // Bytes lost because the USART was not read in time
+    uint16_t uartFrameErrors;  // Bytes dropped with a framing error
+    uint16_t midiOverflows;    // Messages dropped because the ring was full
+    uint8_t midiHighWater;     // Most messages ever waiting in the ring at once
+    uint16_t sysExAccepted;
+    uint16_t sysExRejected;
+    uint16_t twiErrors;        // DAC transfers dropped by the bus
+    uint16_t twiRecoveries;
+    // Version 2
+    uint16_t latencyLast;      // Timer1 counts (16 us) from a MIDI message to its rising edge
+    uint16_t latencyMax;
+    uint8_t settle;            // output_settle, included in the two above
+    uint8_t flags;
+    // Version 3
+    int16_t phaseError;        // Clock PLL, received minus output clock in Timer1 counts
+    uint16_t phaseErrorMax;    // Largest |phaseError| since Start or Continue
+} StatusRecord;
+
+#endif
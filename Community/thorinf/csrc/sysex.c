@@ -0,0 +1,163 @@
+#include "sysex.h"
+
+#include "midi_parser.h"
+#include "pulse.h"
+#include "random.h"
+
+#include <util/atomic.h>
+
+SysEx_Receiver sysExReceiver;
+
+static inline void sysex_expect(SysEx_Receiver *rx, uint8_t first, uint8_t length) {
+    if (length) {
+        rx->staged = config_claim();
+        if (!rx->staged) {  // A save is using the buffer
+            rx->rejected++;
+            rx->state = SYSEX_IDLE;
+            return;
+        }
+    }
+
+    rx->first = first;
+    rx->index = first;
+    rx->end = first + length;
+    rx->group = 0;
+    rx->state = length ? SYSEX_PAYLOAD : SYSEX_CHECKSUM;
+}
+
+uint8_t sysex_receive(SysEx_Receiver *rx, uint8_t byte) {
+    uint8_t state = rx->state;
+
+    if (byte == MIDI_SYSEX_START) {
+        sysex_abort(rx);
+        rx->state = SYSEX_MANUFACTURER_ID;
+        return 0;
+    }
+
+    if (byte & 0x80) {  // F7 or any other status ends the message
+        rx->state = SYSEX_IDLE;
+        if (state == SYSEX_IDLE) return 0;
+
+        if (byte == MIDI_SYSEX_END && state == SYSEX_END && !(rx->sum & 0x7F)) {
+            rx->ready = 1;
+            rx->accepted++;
+            return 1;
+        }
+        if (state >= SYSEX_VERSION_ID) rx->rejected++;
+        if (state >= SYSEX_PAYLOAD) sysex_release(rx);
+        return 0;
+    }
+
+    rx->sum += byte;
+
+    switch (state) {
+        case SYSEX_MANUFACTURER_ID:
+            rx->state = (byte == SYSEX_MANUFACTURER) ? SYSEX_DEVICE_ID : SYSEX_IDLE;
+            break;
+
+        case SYSEX_DEVICE_ID:
+            if (byte != SYSEX_DEVICE) {
+                rx->state = SYSEX_IDLE;
+            } else {
+                rx->sum = 0;
+                rx->state = SYSEX_VERSION_ID;
+            }
+            break;
+
+        case SYSEX_VERSION_ID:
+            if (byte != SYSEX_VERSION || rx->ready) {  // Unknown, or the last update is still staged
+                rx->rejected++;
+                rx->state = SYSEX_IDLE;
+            } else {
+                rx->state = SYSEX_COMMAND;
+            }
+            break;
+
+        case SYSEX_COMMAND:
+            rx->command = byte;
+            if (byte == SYSEX_CMD_MAP) {
+                sysex_expect(rx, 0, MIDI_MAP_SIZE);
+            } else if (byte == SYSEX_CMD_STATUS) {
+                sysex_expect(rx, 0, 0);
+            } else if (byte >= SYSEX_CMD_ENTRY && byte <= SYSEX_CMD_LOOP) {  // The rest take an argument
+                rx->state = SYSEX_ARGUMENT;
+            } else {
+                rx->rejected++;
+                rx->state = SYSEX_IDLE;
+            }
+            break;
+
+        case SYSEX_ARGUMENT:
+            rx->argument = byte;
+            if (rx->command == SYSEX_CMD_ENTRY && byte < NUM_GATES) {
+                sysex_expect(rx, byte * sizeof(MIDIMapEntry), sizeof(MIDIMapEntry));
+            } else if (rx->command == SYSEX_CMD_PRESET && byte < NUM_USER_PRESETS) {
+                sysex_expect(rx, 0, MIDI_MAP_SIZE);
+            } else if (rx->command == SYSEX_CMD_PROGRAM_CHANNEL && (byte < 16 || byte == SYSEX_CHANNEL_OFF)) {
+                sysex_expect(rx, 0, 0);
+            } else if (rx->command == SYSEX_CMD_GATE_TIMING && byte < NUM_GATES) {
+                sysex_expect(rx, 0, sizeof(GateTiming));
+            } else if (rx->command == SYSEX_CMD_LOOP && byte < NUM_GATES) {
+                sysex_expect(rx, 0, sizeof(LfsrLoop));
+            } else {
+                rx->rejected++;
+                rx->state = SYSEX_IDLE;
+            }
+            break;
+
+        case SYSEX_PAYLOAD:
+            if (!rx->group) {
+                rx->msbs = byte;
+                rx->group = 7;
+                break;
+            }
+            rx->staged[rx->index++] = byte | (rx->msbs << 7);
+            rx->msbs >>= 1;
+            rx->group--;
+            if (rx->index == rx->end) rx->state = SYSEX_CHECKSUM;
+            break;
+
+        case SYSEX_CHECKSUM:
+            rx->state = SYSEX_END;
+            break;
+
+        case SYSEX_END:  // Too long
+            rx->rejected++;
+            sysex_abort(rx);
+            break;
+    }
+    return 0;
+}
+
+uint8_t sysex_check(const SysEx_Receiver *rx) {
+    const uint8_t *src = rx->staged;
+
+    for (uint8_t i = rx->first; i < rx->end; i += sizeof(MIDIMapEntry)) {
+        if (src[i] >= NUM_MIDIMAP_TYPES) return 0;  // mapType leads every entry
+    }
+    return 1;
+}
+
+uint8_t sysex_commit(SysEx_Receiver *rx, MIDIMapEntry *map) {
+    const uint8_t *src = rx->staged;
+    uint8_t *dst = (uint8_t *)map;
+    uint8_t changed = 0;
+
+    if (!rx->ready) return 0;
+
+    if (!sysex_check(rx)) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { rx->rejected++; }
+        sysex_release(rx);
+        return 0;
+    }
+
+    for (uint8_t i = rx->first; i < rx->end; i++) {
+        if (dst[i] != src[i]) {
+            changed |= 1 << (i / sizeof(MIDIMapEntry));
+            dst[i] = src[i];
+        }
+    }
+
+    sysex_release(rx);
+    return changed;
+}
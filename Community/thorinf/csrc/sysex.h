@@ -0,0 +1,110 @@
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include <avr/io.h>
+
+#include "config_store.h"
+#include "hardware_config.h"
+#include "midi_buffer.h"
+#include "midimap.h"
+
+// Streaming SysEx receiver, fed one byte at a time from the USART ISR so a map can be
+// sent while the module plays. Every message reads
+//   F0 7D 08 <version> <command> [args] <packed payload> <checksum> F7
+// The payload is 8-to-7 packed: each group of up to seven bytes is sent as one byte
+// holding their top bits, bit n for byte n, followed by the seven low parts. The
+// checksum makes the 7-bit sum of everything from the version on zero.
+//
+//   SYSEX_CMD_MAP              -                    the whole map, 56 bytes in 64 (~24 ms on the wire)
+//   SYSEX_CMD_ENTRY            gate (0-7)           one MIDIMapEntry, 7 bytes in 8 (~5 ms)
+//   SYSEX_CMD_PRESET           user preset (0-2)    a whole map, stored in the preset slot
+//   SYSEX_CMD_PROGRAM_CHANNEL  channel (0-15, 7F)   Program Change channel, 7F turns it off
+//   SYSEX_CMD_STATUS           -                    writes the status snapshot, see status.h
+//   SYSEX_CMD_GATE_TIMING      gate (0-7)           that gate's GateTiming, 3 bytes in 4
+//   SYSEX_CMD_LOOP             gate (0-7)           that gate's LfsrLoop, 2 bytes in 3
+//
+// Payload bytes are written straight into the EEPROM queue buffer, claimed with
+// config_claim() once the command is known, so a preset is stored from where it was
+// received and no RAM is kept aside for staging. Nothing touches midi_map until the
+// message has been checked, sysex_commit() then copies the part it carried over from
+// the main loop. Commands other than MAP and ENTRY are left to the main loop, which
+// hands the buffer back with sysex_release() when it is done with it. A message that
+// arrives while the buffer is in use, e.g. while a save is being written, is turned
+// away. Messages of another version are ignored, so the tool and the firmware can
+// move on separately.
+//
+// Each byte is a handful of compares and one store, no loops, so the USART ISR keeps
+// its bound. Real-time bytes inside the message are fine, they never reach the receiver.
+#define SYSEX_MANUFACTURER 0x7D  // Non-commercial
+#define SYSEX_DEVICE 0x08
+#define SYSEX_VERSION 0x01
+
+// Commands
+#define SYSEX_CMD_MAP 0x01
+#define SYSEX_CMD_ENTRY 0x02
+#define SYSEX_CMD_PRESET 0x03
+#define SYSEX_CMD_PROGRAM_CHANNEL 0x04
+#define SYSEX_CMD_STATUS 0x05
+#define SYSEX_CMD_GATE_TIMING 0x06
+#define SYSEX_CMD_LOOP 0x07
+
+#define SYSEX_CHANNEL_OFF 0x7F
+
+// Receiver states
+#define SYSEX_IDLE 0          // Outside a message, or skipping one that is not ours
+#define SYSEX_MANUFACTURER_ID 1
+#define SYSEX_DEVICE_ID 2
+#define SYSEX_VERSION_ID 3
+#define SYSEX_COMMAND 4
+#define SYSEX_ARGUMENT 5
+#define SYSEX_PAYLOAD 6
+#define SYSEX_CHECKSUM 7
+#define SYSEX_END 8           // Everything in, waiting for F7
+
+typedef struct {
+    uint8_t state;
+    uint8_t command;  // Command of the message being received, or staged once ready
+    uint8_t argument;
+    uint8_t first;    // Staged bytes carried by the message, first to end - 1
+    uint8_t end;
+    uint8_t index;    // Next staged byte to write
+    uint8_t group;    // Low parts still due in the current group, 0 when a top bits byte is next
+    uint8_t msbs;     // Top bits of the current group, next one in bit 0
+    uint8_t sum;
+    volatile uint8_t ready;  // staged holds a checked update the main loop has not taken yet
+    uint16_t accepted;
+    uint16_t rejected;  // Short, long, garbled, unknown or busy messages addressed to us
+    uint8_t *staged;    // Map shaped payload in the claimed EEPROM queue buffer, 0 when none is held
+} SysEx_Receiver;
+
+extern SysEx_Receiver sysExReceiver;
+
+// Hands back the buffer of an update that has not been staged yet or has been dealt
+// with, a write started from it carries on. Lets the receiver stage again.
+static inline void sysex_release(SysEx_Receiver *rx) {
+    if (rx->staged) {
+        rx->staged = 0;
+        eeprom_queue_release();
+    }
+    MIDI_BARRIER();  // Done with staged before it is handed back
+    rx->ready = 0;
+}
+
+// Drops a message part way through, for when the receiver stops being fed. An update
+// already staged is kept for the main loop.
+static inline void sysex_abort(SysEx_Receiver *rx) {
+    if (rx->state >= SYSEX_PAYLOAD) sysex_release(rx);
+    rx->state = SYSEX_IDLE;
+}
+
+// Feeds one non real-time byte, returns 1 when an update has just been staged.
+uint8_t sysex_receive(SysEx_Receiver *rx, uint8_t byte);
+
+// Main loop side. Returns 1 when every staged entry the update carried has a known type.
+uint8_t sysex_check(const SysEx_Receiver *rx);
+
+// Main loop side. Copies a staged update into map and returns the gates whose entry
+// changed, 0 when nothing changed or the update holds an unknown type.
+uint8_t sysex_commit(SysEx_Receiver *rx, MIDIMapEntry *map);
+
+#endif
@@ -0,0 +1,206 @@
+#include "twi_control.h"
+
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include <util/twi.h>
+
+#include "hardware_config.h"
+
+#define TWCR_START ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_CONTINUE ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_STOP_START ((1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_STOP ((1 << TWINT) | (1 << TWSTO) | (1 << TWEN))
+
+TWI_Queue twiQueue;
+
+static uint8_t twiBitrate = TWI_TWBR(TWI_FREQ);
+
+void twi_init(void) {
+    TWSR = 0x00;
+    TWBR = twiBitrate;
+    TWCR = (1 << TWEN);
+}
+
+void twi_set_bitrate(uint8_t twbr) {
+    twiBitrate = twbr;
+    TWBR = twbr;
+}
+
+uint8_t twi_get_bitrate(void) { return twiBitrate; }
+
+static uint8_t twi_wait(void) {
+    for (uint8_t us = 0; us < TWI_BYTE_TIMEOUT_US; us++) {
+        if (TWCR & (1 << TWINT)) return 1;
+        _delay_us(1);
+    }
+    return 0;
+}
+
+uint8_t twi_start(void) {
+    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+    if (!twi_wait()) return 0;
+    return TW_STATUS == TW_START || TW_STATUS == TW_REP_START;
+}
+
+uint8_t twi_write(uint8_t data) {
+    TWDR = data;
+    TWCR = (1 << TWINT) | (1 << TWEN);
+    if (!twi_wait()) return 0;
+    return TW_STATUS == TW_MT_SLA_ACK || TW_STATUS == TW_MT_DATA_ACK || TW_STATUS == TW_MR_SLA_ACK;
+}
+
+uint8_t twi_read(uint8_t *data, uint8_t ack) {
+    TWCR = (1 << TWINT) | (1 << TWEN) | (ack ? (1 << TWEA) : 0);
+    if (!twi_wait()) return 0;
+    *data = TWDR;
+    return TW_STATUS == (ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+}
+
+void twi_recover(void) {
+    uint8_t sreg = SREG;
+    cli();
+
+    // Hand the pins back to the port, driving low through DDR keeps them open drain
+    TWCR = 0;
+    PORTC &= ~((1 << SDA_PIN) | (1 << SCL_PIN));
+    DDRC &= ~((1 << SDA_PIN) | (1 << SCL_PIN));
+
+    for (uint8_t i = 0; i < 9 && !(PINC & (1 << SDA_PIN)); i++) {
+        DDRC |= (1 << SCL_PIN);
+        _delay_us(5);
+        DDRC &= ~(1 << SCL_PIN);
+        _delay_us(5);
+    }
+
+    // STOP, SDA rises while SCL is high
+    DDRC |= (1 << SCL_PIN);
+    DDRC |= (1 << SDA_PIN);
+    _delay_us(5);
+    DDRC &= ~(1 << SCL_PIN);
+    _delay_us(5);
+    DDRC &= ~(1 << SDA_PIN);
+    _delay_us(5);
+
+    twi_init();
+    twiQueue.recoveries++;
+
+    if (twiQueue.busy) {
+        twiQueue.errors++;
+        twiQueue.tail++;
+        twiQueue.busy = 0;
+        if (twiQueue.tail != twiQueue.head) {
+            twiQueue.busy = 1;
+            TWCR = TWCR_START;
+        }
+    }
+
+    SREG = sreg;
+}
+
+void twi_watchdog(void) {
+    static uint8_t lastProgress;
+    static uint8_t stalledTicks;
+    uint8_t progress = twiQueue.progress;
+
+    if (!twiQueue.busy || progress != lastProgress) {
+        lastProgress = progress;
+        stalledTicks = 0;
+    } else if (++stalledTicks >= TWI_STALL_TICKS) {
+        twi_recover();
+        stalledTicks = 0;
+    }
+}
+
+static TWI_Transaction *twi_reserve(uint8_t address, uint8_t length, uint8_t flags) {
+    uint8_t head = twiQueue.head;
+    uint16_t waited = 0;
+
+    while ((uint8_t)(head - twiQueue.tail) >= TWI_QUEUE_SIZE) {
+        if (++waited > TWI_QUEUE_TIMEOUT_US) {
+            twi_recover();
+            waited = 0;
+        }
+        _delay_us(1);
+    }
+
+    TWI_Transaction *txn = &twiQueue.transactions[head & TWI_QUEUE_MASK];
+    txn->address = address;
+    txn->length = length;
+    txn->flags = flags;
+    return txn;
+}
+
+static uint8_t twi_publish(void) {
+    uint8_t head = twiQueue.head;
+
+    __asm__ __volatile__("" ::: "memory");
+    twiQueue.head = ++head;
+
+    // TWI_vect cannot run while the engine is idle, so this cannot race with it
+    if (!twiQueue.busy) {
+        twiQueue.busy = 1;
+        TWCR = TWCR_START;
+    }
+    return head;
+}
+
+uint8_t twi_enqueue(uint8_t address, const uint8_t *data, uint8_t length) {
+    TWI_Transaction *txn = twi_reserve(address, length, 0);
+
+    for (uint8_t i = 0; i < length; i++) {
+        txn->data[i] = data[i];
+    }
+    txn->buffer = txn->data;
+    return twi_publish();
+}
+
+uint8_t twi_enqueue_buffer(uint8_t address, const uint8_t *buffer, uint8_t length, uint8_t flags) {
+    TWI_Transaction *txn = twi_reserve(address, length, flags);
+
+    txn->buffer = buffer;
+    return twi_publish();
+}
+
+ISR(TWI_vect) {
+    TWI_Transaction *txn = &twiQueue.transactions[twiQueue.tail & TWI_QUEUE_MASK];
+    uint8_t status = TW_STATUS;
+
+    twiQueue.progress++;
+
+    switch (status) {
+        case TW_START:
+        case TW_REP_START:
+            twiQueue.index = 0;
+            TWDR = txn->address;
+            TWCR = TWCR_CONTINUE;
+            return;
+
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (twiQueue.index < txn->length) {
+                TWDR = txn->buffer[twiQueue.index++];
+                TWCR = TWCR_CONTINUE;
+                return;
+            }
+            twiQueue.lastStatus = TWI_OK;
+            if (txn->flags & TWI_FLAG_LDAC) {
+                LDAC_PORT &= ~(1 << LDAC_PIN);  // Codes are in, load every channel at once
+                LDAC_PORT |= (1 << LDAC_PIN);
+            }
+            break;
+
+        default:  // NACK, arbitration lost or bus error, the transaction is dropped
+            twiQueue.lastStatus = status;
+            twiQueue.errors++;
+            break;
+    }
+
+    twiQueue.tail++;
+
+    if (twiQueue.tail != twiQueue.head) {
+        TWCR = TWCR_STOP_START;
+    } else {
+        TWCR = TWCR_STOP;
+        twiQueue.busy = 0;
+    }
+}
@@ -11,27 +11,88 @@
 #define TWI_FREQ 400000UL
 #endif
 
+// SCL = F_CPU / (16 + 2 * TWBR) with no prescaler, TWBR 0 gives 1 MHz
+#define TWI_TWBR(freq) ((uint8_t)(((F_CPU / (freq)) - 16) / 2))
 
-void twi_init(void) {
-    TWSR = 0x00; 
-    TWBR = (uint8_t)(((F_CPU / TWI_FREQ) - 16) / 2);
-    TWCR = (1 << TWEN);
-}
+// Write transactions are queued and shifted out by TWI_vect, one START/STOP each.
+// Tickets are free-running so callers can tell when their transaction has finished.
+#define TWI_QUEUE_SIZE 4  // Must be a power of two, play keeps one DAC batch on the bus at a time
+#define TWI_QUEUE_MASK (TWI_QUEUE_SIZE - 1)
+#define TWI_MAX_DATA 3  // Longer writes pass a buffer the caller keeps intact until complete
+
+#define TWI_FLAG_LDAC 0x01  // Pulse LDAC once the transaction is acknowledged
+
+#define TWI_OK 0xFF  // Last status when the transaction was acknowledged throughout
+
+// Worst-case timing at 400 kHz: a byte is 22.5 us on the wire, so a single channel DAC
+// write (4 bytes) takes ~100 us and a full eight channel batch (25 bytes) ~580 us. A DAC
+// write waits at most for the batch ahead of it and lands within ~1.2 ms. A bus that
+// stops making progress is reset by twi_watchdog() after TWI_STALL_TICKS ticks, or by a
+// full queue after TWI_QUEUE_TIMEOUT_US, and twi_recover() itself takes ~120 us.
+#define TWI_BYTE_TIMEOUT_US 100     // Blocking primitives give up on TWINT after this
+#define TWI_QUEUE_TIMEOUT_US 2000   // twi_enqueue() waits this long for a free slot
+#define TWI_STALL_TICKS 10
+
+typedef struct {
+    uint8_t address;  // Address byte with the write bit clear
+    uint8_t length;
+    uint8_t flags;
+    const uint8_t *buffer;  // Either data below or caller storage
+    uint8_t data[TWI_MAX_DATA];
+} TWI_Transaction;
+
+typedef struct {
+    TWI_Transaction transactions[TWI_QUEUE_SIZE];
+    volatile uint8_t head;        // Only written by twi_enqueue()
+    volatile uint8_t tail;        // Only written by TWI_vect, counts finished transactions
+    volatile uint8_t index;       // Next data byte of the transaction on the bus
+    volatile uint8_t busy;
+    volatile uint8_t progress;    // Bumped on every TWI_vect, lets twi_watchdog() spot a stuck bus
+    volatile uint8_t lastStatus;  // TWI_OK or the TW_STATUS that ended the last transaction
+    volatile uint16_t errors;     // Transactions dropped on NACK, arbitration loss, bus error or recovery
+    volatile uint16_t recoveries;  // Times the bus was cleared by twi_recover()
+} TWI_Queue;
+
+extern TWI_Queue twiQueue;
+
+void twi_init(void);
+
+// Selects the bit rate used from now on, including after twi_recover().
+void twi_set_bitrate(uint8_t twbr);
+uint8_t twi_get_bitrate(void);
 
-static inline void twi_start(void) {
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-    while (!(TWCR & (1 << TWINT)));
+// Queues a write and returns at once, unless the queue is full in which case it waits
+// for a slot, recovering the bus if none frees up in time. Interrupts must be enabled.
+// Returns the ticket for twi_complete().
+uint8_t twi_enqueue(uint8_t address, const uint8_t *data, uint8_t length);
+
+// As twi_enqueue() but the bytes are read from buffer while the transaction is on the bus.
+uint8_t twi_enqueue_buffer(uint8_t address, const uint8_t *buffer, uint8_t length, uint8_t flags);
+
+// A ticket is pending while it lies in (tail, head].
+static inline uint8_t twi_complete(uint8_t ticket) {
+    uint8_t tail = twiQueue.tail;
+    return (uint8_t)(ticket - tail - 1) >= (uint8_t)(twiQueue.head - tail);
 }
 
+static inline uint8_t twi_busy(void) { return twiQueue.busy; }
+
+// Called once per tick, clears the bus if the engine is busy without making progress.
+void twi_watchdog(void);
+
+// Releases a slave holding SDA by clocking SCL, sends STOP and restarts the engine.
+// The transaction on the bus is dropped, the rest of the queue is kept.
+void twi_recover(void);
+
+// Blocking primitives, only for use while the queue is idle. Each wait on TWINT is
+// bounded by TWI_BYTE_TIMEOUT_US and the TW_STATUS is checked, 1 means success.
+uint8_t twi_start(void);
+uint8_t twi_write(uint8_t data);
+uint8_t twi_read(uint8_t *data, uint8_t ack);
+
 static inline void twi_stop(void) {
     TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
     // No need to wait for stop condition to complete
 }
 
-static inline void twi_write(uint8_t data) {
-    TWDR = data;
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    while (!(TWCR & (1 << TWINT)));
-}
-
 #endif
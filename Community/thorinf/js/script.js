@@ -4,10 +4,44 @@ const MIDIMAP_PITCH = 2;
 const MIDIMAP_PITCH_SAH = 3;
 const MIDIMAP_RANDSEQ = 4;
 const MIDIMAP_RANDSEQ_SAH = 5;
+const MIDIMAP_CLOCK = 6;
 
 const channelOptions = Array.from({ length: 16 }, (_, i) => ({ value: 0x90 + i, text: `Channel ${i + 1}` }));
 const noteOptions = Array.from({ length: 128 }, (_, i) => ({ value: i, text: `Note ${i}` }));
 const controllerOptions = Array.from({ length: 128 }, (_, i) => ({ value: i, text: `Controller ${i}` }));
+const clockSourceOptions = [{ value: 0xF8, text: "MIDI Clock" }];
+const clockDivisionOptions = [
+    { value: 1, text: "24 PPQN" },
+    { value: 3, text: "1/32" },
+    { value: 4, text: "1/16 Triplet" },
+    { value: 6, text: "1/16" },
+    { value: 8, text: "1/8 Triplet" },
+    { value: 12, text: "1/8" },
+    { value: 16, text: "1/4 Triplet" },
+    { value: 24, text: "1/4" },
+    { value: 32, text: "1/2 Triplet" },
+    { value: 48, text: "1/2" },
+    { value: 96, text: "1 Bar" },
+    { value: 192, text: "2 Bars" }
+];
+const clockOffsetOptions = Array.from({ length: 96 }, (_, i) => ({ value: i, text: `${i} Clocks` }));
+const clockResetOptions = [{ value: 0, text: "Free Running" }, { value: 1, text: "Reset on Start" }];
+const clockRateOptions = [
+    { value: 0, text: "24 PPQN, As Received" },
+    { value: 1, text: "24 PPQN, Filtered" },
+    { value: 2, text: "48 PPQN" },
+    { value: 3, text: "96 PPQN" }
+];
+
+const presetSlotOptions = Array.from({ length: 3 }, (_, i) => ({ value: i, text: `User Preset ${i + 1} (Program ${i + 3})` }));
+const programChannelOptions = [{ value: 0x7F, text: "Off" }]
+    .concat(Array.from({ length: 16 }, (_, i) => ({ value: i, text: `Channel ${i + 1}` })));
+const gateOptions = Array.from({ length: 8 }, (_, i) => ({ value: i, text: `Gate ${i + 1}` }));
+const timingLabels = ["Trigger Length", "Minimum Length", "Retrigger Gap"];
+const timingOptions = timingLabels.map(label =>
+    Array.from({ length: 256 }, (_, i) => ({ value: i, text: `${label}: ${i ? `${i} ms` : "Off"}` })));
+const loopLengthOptions = Array.from({ length: 256 }, (_, i) => ({ value: i, text: i ? `Loop ${i} Steps` : "Free Running" }));
+const loopStartOptions = Array.from({ length: 256 }, (_, i) => ({ value: i, text: `Start at Step ${i}` }));
 
 const midiModeOptions = [
     {
@@ -45,6 +79,12 @@ const midiModeOptions = [
         text: "Random Step Sequencer, Sample & Hold",
         requiredOptions: [channelOptions, noteOptions, channelOptions, noteOptions, channelOptions, noteOptions],
         requiredLabels: ["Gate Channel", "Gate Note", "Step Channel", "Step Note", "Reset Channel", "Reset Note"]
+    },
+    {
+        value: 6,
+        text: "Clock Divider",
+        requiredOptions: [clockSourceOptions, clockDivisionOptions, clockOffsetOptions, clockResetOptions, clockRateOptions],
+        requiredLabels: ["Source", "Division", "Offset", "Start", "Rate"]
     }
 ];
 
@@ -159,16 +199,18 @@ function updateGlobalArray(rowIndex, columnIndex, newValue) {
     localStorage.setItem('globalArray', JSON.stringify(globalArray));
 }
 
-function updateTextAreaFromArray() {
-    const arrayTextArea = document.getElementById('arrayTextArea');
-
-    const maskedArray = globalArray.slice(0, 8).map((row) => {
+// The map as the device gets it, fields the MIDI mode does not use are zeroed.
+function maskedRows() {
+    return globalArray.slice(0, 8).map((row) => {
         const numKeep = midiModeOptions[row[0]].requiredLabels.length + 1;
         const numPad = row.length - numKeep; 
         return row.slice(0, numKeep).concat(Array(numPad).fill(0)); 
     });
+}
 
-    arrayTextArea.value = JSON.stringify(maskedArray, null, 0);
+function updateTextAreaFromArray() {
+    const arrayTextArea = document.getElementById('arrayTextArea');
+    arrayTextArea.value = JSON.stringify(maskedRows(), null, 0);
 }
 
 function updateArrayFromTextArea() {
@@ -196,11 +238,43 @@ function updateArrayFromTextArea() {
     }
 }
 
-async function sendSysExMessageWithPauses() {
+const SYSEX_MANUFACTURER = 0x7D;  // Non-commercial
+const SYSEX_DEVICE = 0x08;
+const SYSEX_VERSION = 0x01;
+const SYSEX_CMD_MAP = 0x01;
+const SYSEX_CMD_ENTRY = 0x02;
+const SYSEX_CMD_PRESET = 0x03;
+const SYSEX_CMD_PROGRAM_CHANNEL = 0x04;
+const SYSEX_CMD_STATUS = 0x05;
+const SYSEX_CMD_GATE_TIMING = 0x06;
+const SYSEX_CMD_LOOP = 0x07;
+
+// The map as last sent whole, null sends the whole map next. Entry messages are not
+// counted as delivered, the device turns them away while it is saving or in the menu,
+// so Send Changes sends every gate edited since the last full send.
+let lastSentRows = null;
+let savingUntil = 0;  // When a save the tool started leaves the device's buffer free again
+
+// A save programs at most a 64 byte record, 8.5 ms a byte.
+const SAVE_WINDOW_MS = 600;
+let presetSlot = 0;
+let programChannel = 15;
+let timingGate = 0;
+let gateTiming = [0, 0, 0];  // Trigger length, minimum length, retrigger gap in ms
+let loopGate = 0;
+let sequenceLoop = [0, 0];  // Length in steps, start step
+
+async function withMIDIOutput(send) {
     if (navigator.requestMIDIAccess) {
         try {
             const midiAccess = await navigator.requestMIDIAccess({ sysex: true });
-            onMIDISuccess(midiAccess);
+            const outputs = Array.from(midiAccess.outputs.values());
+
+            if (outputs.length > 0) {
+                await send(outputs[0]);
+            } else {
+                console.log("No MIDI output devices available.");
+            }
         } catch (error) {
             console.error("Failed to access MIDI devices:", error);
         }
@@ -209,38 +283,164 @@ async function sendSysExMessageWithPauses() {
     }
 }
 
-async function onMIDISuccess(midiAccess) {
-    const outputs = Array.from(midiAccess.outputs.values());
+function sendSysExMessageWithPauses(fullMap = false) {
+    return withMIDIOutput(output => sendMap(output, fullMap));
+}
 
-    const maskedArray = globalArray.slice(0, 8).map((row) => {
-        const numKeep = midiModeOptions[row[0]].requiredLabels.length + 1;
-        const numPad = row.length - numKeep; 
-        return row.slice(0, numKeep).concat(Array(numPad).fill(0)); 
-    });
+// Called after every command the device saves straight away.
+function noteSave() {
+    savingUntil = Date.now() + SAVE_WINDOW_MS;
+}
 
-    if (outputs.length > 0) {
-        const output = outputs[0];
-        const sysExMessage = asSysEx(maskedArray)
-        output.send(sysExMessage);
-        console.log("Sent SysEx message:", sysExMessage);
+// Payload messages sent while a save is being written would be turned away.
+async function waitForSave() {
+    const wait = savingUntil - Date.now();
+
+    if (wait > 0) {
+        console.log(`Waiting ${wait} ms for the device to finish saving.`);
+        await delay(wait);
+    }
+}
+
+async function sendMap(output, fullMap) {
+    const maskedArray = maskedRows();
+    const changed = maskedArray
+        .map((row, index) => index)
+        .filter(index => !lastSentRows || JSON.stringify(maskedArray[index]) !== JSON.stringify(lastSentRows[index]));
+    const entryMessages = changed.map(index => asSysExEntry(index, maskedArray[index]));
+    const mapMessage = asSysEx(maskedArray);
+    const entryBytes = entryMessages.reduce((total, message) => total + message.length, 0);
+
+    await waitForSave();
+    if (fullMap || !lastSentRows || entryBytes >= mapMessage.length) {
+        output.send(mapMessage);
+        lastSentRows = maskedArray;
+        console.log("Sent SysEx map:", mapMessage);
+    } else if (entryMessages.length === 0) {
+        console.log("Nothing changed since the last full send.");
     } else {
-        console.log("No MIDI output devices available.");
+        for (const message of entryMessages) {
+            output.send(message);
+            await delay(10);  // Each update is committed before the next one is staged
+        }
+        console.log("Sent SysEx entries:", changed, entryMessages);
     }
 }
 
-function asSysEx(array) {
-    const sysExArray = [0xF0];
-    array.flat().forEach(value => {
-        sysExArray.push(value & 0x7F);  // Push the least significant 7 bits
-        sysExArray.push((value >>= 7) & 0x7F);  // Push the remaining 7 bits if non-zero
+// Stores the map in a user preset slot on the device, the map it plays is not changed.
+function storePreset() {
+    return withMIDIOutput(async output => {
+        await waitForSave();
+        const message = sysExMessage(SYSEX_CMD_PRESET, [presetSlot], maskedRows().flat().map(value => value & 0xFF));
+        output.send(message);
+        noteSave();
+        console.log("Sent SysEx preset:", presetSlot, message);
     });
-    sysExArray.push(0xF7);
-    return sysExArray;
+}
+
+function sendProgramChannel() {
+    return withMIDIOutput(output => {
+        const message = sysExMessage(SYSEX_CMD_PROGRAM_CHANNEL, [programChannel], []);
+        output.send(message);
+        noteSave();
+        console.log("Sent SysEx program channel:", programChannel, message);
+    });
+}
+
+// Gate timing is saved on the device straight away, it is not part of the map.
+function sendGateTiming() {
+    return withMIDIOutput(async output => {
+        await waitForSave();
+        const message = sysExMessage(SYSEX_CMD_GATE_TIMING, [timingGate], gateTiming);
+        output.send(message);
+        noteSave();
+        console.log("Sent SysEx gate timing:", timingGate, gateTiming, message);
+    });
+}
+
+// Loop of a random step sequence, saved on the device straight away.
+function sendSequenceLoop() {
+    return withMIDIOutput(async output => {
+        await waitForSave();
+        const message = sysExMessage(SYSEX_CMD_LOOP, [loopGate], sequenceLoop);
+        output.send(message);
+        noteSave();
+        console.log("Sent SysEx sequence loop:", loopGate, sequenceLoop, message);
+    });
+}
+
+// Has the device write its diagnostic counters to EEPROM, to be read with a programmer.
+function saveStatus() {
+    return withMIDIOutput(output => {
+        const message = sysExMessage(SYSEX_CMD_STATUS, [], []);
+        output.send(message);
+        noteSave();
+        console.log("Sent SysEx status request:", message);
+    });
+}
+
+function initializePresetControls() {
+    const presetArea = document.getElementById('presetArea');
+
+    presetArea.prepend(
+        createDropdown(presetSlotOptions, presetSlot, (newValue) => { presetSlot = newValue; }),
+        document.getElementById('storePresetButton'),
+        createDropdown(programChannelOptions, programChannel, (newValue) => { programChannel = newValue; })
+    );
+
+    document.getElementById('timingArea').prepend(
+        createDropdown(gateOptions, timingGate, (newValue) => { timingGate = newValue; }),
+        ...timingOptions.map((options, field) =>
+            createDropdown(options, gateTiming[field], (newValue) => { gateTiming[field] = newValue; }))
+    );
+
+    document.getElementById('loopArea').prepend(
+        createDropdown(gateOptions, loopGate, (newValue) => { loopGate = newValue; }),
+        createDropdown(loopLengthOptions, sequenceLoop[0], (newValue) => { sequenceLoop[0] = newValue; }),
+        createDropdown(loopStartOptions, sequenceLoop[1], (newValue) => { sequenceLoop[1] = newValue; })
+    );
+}
+
+// Standard 8-to-7 packing: each group of up to seven bytes goes out as one byte with
+// their top bits, bit n for byte n, followed by the low seven bits of each.
+function packSysEx(bytes) {
+    const packed = [];
+    for (let i = 0; i < bytes.length; i += 7) {
+        const group = bytes.slice(i, i + 7);
+        packed.push(group.reduce((msbs, value, bit) => msbs | (((value >> 7) & 1) << bit), 0));
+        group.forEach(value => packed.push(value & 0x7F));
+    }
+    return packed;
+}
+
+// F0 7D 08 <version> <command> [args] <packed payload> <checksum> F7, the checksum makes
+// the 7-bit sum of everything from the version on zero.
+function sysExMessage(command, args, bytes) {
+    const body = [SYSEX_VERSION, command, ...args, ...packSysEx(bytes)];
+    const sum = body.reduce((total, value) => total + value, 0);
+    return [0xF0, SYSEX_MANUFACTURER, SYSEX_DEVICE, ...body, (128 - (sum & 0x7F)) & 0x7F, 0xF7];
+}
+
+function asSysEx(array) {
+    return sysExMessage(SYSEX_CMD_MAP, [], array.flat().map(value => value & 0xFF));
+}
+
+function asSysExEntry(index, row) {
+    return sysExMessage(SYSEX_CMD_ENTRY, [index], row.map(value => value & 0xFF));
 }
 
 function delay(ms) {
     return new Promise(resolve => setTimeout(resolve, ms));
 }
 
-document.getElementById("sendSysExButton").addEventListener("click", sendSysExMessageWithPauses);
-window.onload = initializeDropdowns;
+document.getElementById("sendSysExButton").addEventListener("click", () => sendSysExMessageWithPauses(false));
+document.getElementById("sendFullMapButton").addEventListener("click", () => sendSysExMessageWithPauses(true));
+document.getElementById("storePresetButton").addEventListener("click", storePreset);
+document.getElementById("programChannelButton").addEventListener("click", sendProgramChannel);
+document.getElementById("gateTimingButton").addEventListener("click", sendGateTiming);
+document.getElementById("loopButton").addEventListener("click", sendSequenceLoop);
+document.getElementById("statusButton").addEventListener("click", saveStatus);
+window.onload = () => {
+    initializeDropdowns();
+    initializePresetControls();
+};
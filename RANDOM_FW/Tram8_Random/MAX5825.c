@@ -56,4 +56,11 @@ void max5825_set_load_all(max_fill_struct * data){
 	TWI_WRITE_BULK(MAX5825_ADDR,cmd_addr,23,data);
 	
 	
+}
+
+//same frame, but every command has to be a plain CODEn so nothing reaches the outputs until LDAC
+void max5825_set_code_all(max_fill_struct * data){
+	uint8_t cmd_addr = (MAX5825_REG_CODEn | 0);
+	
+	TWI_WRITE_BULK(MAX5825_ADDR,cmd_addr,23,data);
 }
\ No newline at end of file
@@ -39,6 +39,9 @@
 #define MAX5825_REG_CODELOADALL		0xC2
 #define MAX5825_REG_RETURNALL		0xC3
 
+//LDAC is active low on PC2, a pulse moves every CODE register into its DAC at once
+#define MAX5825_LDAC_PULSE()	do{ PORTC &= ~(1 << PC2); PORTC |= (1 << PC2); }while(0)
+
 typedef struct{
 	uint16_t	dac0_val;
 	uint8_t		dac1_cmd;
@@ -63,6 +66,7 @@ void init_max5825(void);
 uint8_t test_max5825(void);
 void max5825_set_load_channel(uint8_t ch, uint16_t value);
 void max5825_set_load_all(max_fill_struct * data);
+void max5825_set_code_all(max_fill_struct * data);
 
 
 
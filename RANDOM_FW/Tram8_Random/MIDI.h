@@ -28,6 +28,7 @@
 #define MIDI_START 0xFA
 #define MIDI_STOP 0xFC
 #define MIDI_CONT 0xFB
+#define MIDI_SPP 0xF2
 
 uint16_t velocity_lookup[128] = {
 0x0000, 
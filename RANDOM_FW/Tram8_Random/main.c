@@ -85,6 +85,8 @@ uint8_t midi_tripl_cntr=0;
 uint8_t midi_clock_run=0;
 uint8_t midi_quarter_cntr=0;
 uint8_t midi_quarter_cntr_prev = 0;
+uint8_t midi_spp_bytes = 0; //data bytes of a song position still to come
+uint16_t midi_spp = 0;
 uint8_t sync_counter_match = (1 << 2); //1=QRT 2=HLF 4=BAR 8=2BAR etc.
 uint8_t wait_for_match = 0;
 uint8_t boundary_led_flag = 0;
@@ -93,7 +95,7 @@ uint8_t group_hold = 0;
 uint8_t midi_note_map[8] = {60,61,62,63,64,65,66,67};
 uint8_t midi_note_map_default[8] = {60,61,62,63,64,65,66,67};
 	
-int rand_values[8] = {0,0,0,0,0,0,0,0};	
+volatile uint8_t dac_frame_ready = 0; //CODE registers hold the next 16th, waiting for LDAC
 
 uint8_t midi_buff[3] = {0,0,0};
 uint8_t midi_buff_point = 0;
@@ -256,7 +258,7 @@ int main(void)
 	all_dacs.dac4_cmd = MAX5825_REG_CODEn | 4;
 	all_dacs.dac5_cmd = MAX5825_REG_CODEn | 5;
 	all_dacs.dac6_cmd = MAX5825_REG_CODEn | 6;	
-	all_dacs.dac7_cmd = MAX5825_REG_CODEn_LOADall | 7;		
+	all_dacs.dac7_cmd = MAX5825_REG_CODEn | 7; //loaded by LDAC on the 16th, see dac_frame_ready		
 	
 	
 	midi_learn_mode = 0;
@@ -270,107 +272,72 @@ int main(void)
 	static uint8_t button_now = 0;
 	static uint8_t button_bounce = 0;
 	static uint8_t button_last = 0;
-	static uint8_t nxt_rand=0;
 	static int int16_temp;
 	static int rand_2_temp;
 	static int rand_5_temp;
-	static uint8_t calc_update_flag = 1;
-	static uint8_t dac_update_flag = 1;
-		
-	if(midi_clock_tick_cntr%6==5){
-		calc_update_flag = 1; 
-		dac_update_flag = 1;//so the DAC is only updated one every 16ths
-	}
 	
-	if (midi_clock_tick_cntr%6==0)
+	//the next 16th is computed as soon as the last one was latched, streamed into the CODE registers
+	//and only moved to the outputs by the LDAC pulse in the clock ISR, right with the 4PPQN edge
+	if (!dac_frame_ready && learn_button!=BUTTON_DOWN)
 	{
-		if(calc_update_flag){
+		//midi_clock_cntr is still the 16th that was just latched, so the values match the old tick-0 update
+		all_dacs.dac0_val = rand();
+		all_dacs.dac1_val = rand();
 
-			//channel 3 brownian noise
-			int16_temp = rand()>>2; //half random
+		//channel 3 brownian noise
+		int16_temp = rand()>>2; //half random
 	
-			if(int16_temp>0x1000)//{
-				int16_temp |= 0xE000; //MAKE IT MINUS!!  		
+		if(int16_temp>0x1000)//{
+			int16_temp |= 0xE000; //MAKE IT MINUS!!  		
 		
-			rand_2_temp += int16_temp;	
+		rand_2_temp += int16_temp;	
 
-			if(rand_2_temp>16383)
-				rand_2_temp=16383;
-			if(rand_2_temp<0)
-				rand_2_temp=0;
+		if(rand_2_temp>16383)
+			rand_2_temp=16383;
+		if(rand_2_temp<0)
+			rand_2_temp=0;
 		
-			int16_temp = (uint16_t) rand_2_temp<<2;
-				
-			all_dacs.dac2_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
-			all_dacs.dac2_val |= (int16_temp & 0x00F0)<<8;		
+		int16_temp = (uint16_t) rand_2_temp<<2;
+			
+		all_dacs.dac2_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
+		all_dacs.dac2_val |= (int16_temp & 0x00F0)<<8;		
 		
-			//channel 8 ramp up
-			int16_temp = 4095 * (midi_clock_cntr & 0x0F);
+		//channel 8 ramp up
+		int16_temp = 4095 * (midi_clock_cntr & 0x0F);
 		
-			all_dacs.dac7_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
-			all_dacs.dac7_val |= (int16_temp & 0x00F0)<<8;			
+		all_dacs.dac7_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
+		all_dacs.dac7_val |= (int16_temp & 0x00F0)<<8;			
 		
-			if (midi_clock_cntr%4==0)
-			{
-			
-				all_dacs.dac3_val = rand_values[3];
-				all_dacs.dac4_val = rand_values[4];
-			
-				int16_temp = rand()>>2; //half random
+		if (midi_clock_cntr%4==0)
+		{
+		
+			all_dacs.dac3_val = rand();
+			all_dacs.dac4_val = rand();
+		
+			int16_temp = rand()>>2; //half random
+		
+			if(int16_temp>0x1000)//{
+				int16_temp |= 0xE000; //MAKE IT MINUS!!
 			
-				if(int16_temp>0x1000)//{
-					int16_temp |= 0xE000; //MAKE IT MINUS!!
-				
-					rand_5_temp += int16_temp;
-
-					if(rand_5_temp>16383)
-					rand_5_temp=16383;
-					if(rand_5_temp<0)
-					rand_5_temp=0;
+				rand_5_temp += int16_temp;
 
-					int16_temp = (uint16_t) rand_5_temp<<2;
-				
-					all_dacs.dac5_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
-					all_dacs.dac5_val |= (int16_temp & 0x00F0)<<8;
-
-			}
-			
-			if (midi_clock_cntr%16 == 0)
-				all_dacs.dac6_val = rand_values[6];
-			
-			if (learn_button!=BUTTON_DOWN)
-				max5825_set_load_all(&all_dacs);				
+				if(rand_5_temp>16383)
+				rand_5_temp=16383;
+				if(rand_5_temp<0)
+				rand_5_temp=0;
 
-					
+				int16_temp = (uint16_t) rand_5_temp<<2;
 			
+				all_dacs.dac5_val =	(int16_temp & 0xFF00)>>8; //4095 * (midi_clock_cntr & 0x0F);
+				all_dacs.dac5_val |= (int16_temp & 0x00F0)<<8;
 
-			
-			calc_update_flag=0;
-			
 		}
-	}else{
-		//random scheduler 		
-		nxt_rand++;
-		if(nxt_rand>=10)
-			nxt_rand=0;
 		
-		switch(nxt_rand){
-			case 0: 
-			case 7:
-			case 9:		all_dacs.dac0_val = rand(); break;//directly cos updates only on 16ths anyway
-			
-			case 1:
-			case 8:
-			case 10:	all_dacs.dac1_val = rand(); break; //directly cos updates only on 16ths anyway
-			
-			case 3:		rand_values[3] = rand();	break;
-			
-			case 4: 	rand_values[4] = rand();	break;
-			
-			case 6:		rand_values[6] = rand();	break; 		
+		if (midi_clock_cntr%16 == 0)
+			all_dacs.dac6_val = rand();
 		
-			default: break;
-		}		
+		max5825_set_code_all(&all_dacs);
+		dac_frame_ready = 1; //only now the ISR may latch it, never a half written frame
 	}
 	
 	
@@ -501,6 +468,12 @@ ISR(USART_RXC_vect)
 	
 	if ((uart_data>>MIDI_STATUS_bit)&1)
 	{
+		if (uart_data == MIDI_SPP){
+			midi_spp_bytes = 2;
+			midi_spp = 0;
+		} else if (uart_data < MIDI_CLK)
+			midi_spp_bytes = 0; //real time bytes may sit inside, anything else ends it
+		
 		if (uart_data == MIDI_START){
 			midi_clock_run = 1;
 			midi_clock_tick_cntr=0;
@@ -537,6 +510,10 @@ ISR(USART_RXC_vect)
 		
 		
 		if(midi_clock_tick_cntr == 1) {
+			if (dac_frame_ready){ //CVs first, the gates follow within microseconds
+				MAX5825_LDAC_PULSE();
+				dac_frame_ready = 0;
+			}
 			(*set_pin_ptr)(PIN_4PPQN);
 			midi_clock_cntr++;
 			midi_tripl_cntr++;
@@ -573,6 +550,19 @@ ISR(USART_RXC_vect)
 		
 		}
 	} 
+	else if (midi_spp_bytes) {
+		//song position in 16ths: next clock starts 16th midi_spp
+		if (midi_spp_bytes == 2)
+			midi_spp = uart_data;
+		else {
+			midi_spp |= (uint16_t)uart_data << 7;
+			midi_clock_tick_cntr = 0;
+			midi_clock_cntr = midi_spp; //counters only ever test low bits, wrap is fine
+			midi_tripl_cntr = midi_spp % 3;
+			midi_quarter_cntr = (midi_spp + 3) >> 2; //quarters already started
+		}
+		midi_spp_bytes--;
+	}
 		//else if (midi_buff_allowed > 0) {
 		////receive bytes of instruction if allowed
 		//midi_buff[midi_buff_point] = uart_data;
@@ -0,0 +1,237 @@
+# Host check of the clock tempo tracker in Community/thorinf/csrc/clock.c: the PLL
+# update and sub-tick scheduling ported line for line, Timer1 and its compare B
+# simulated in 16 us counts. Reports how received clock jitter comes out on a 96ppqn
+# gate, and how many clocks the output takes to settle after a tempo jump.
+#   jitter:  120 BPM with every clock moved by up to +-JITTER_MS at random
+#   jump:    120 BPM, then 10% faster, no jitter
+# AVR cycle counts are not measured here.
+
+import random
+
+COUNT_US = 16  # F_CPU / 256
+SUBTICKS = 4
+FREQUENCY_SHIFT = 3
+PHASE_SHIFT = 2
+JITTER_MS = 1.0
+SETTLED_COUNTS = 16  # |phase error| the jump test calls settled, 256 us
+CLOCKS = 400
+
+
+def u16(x):
+    return x & 0xFFFF
+
+
+def u32(x):
+    return x & 0xFFFFFFFF
+
+
+def s8(x):
+    x &= 0xFF
+    return x - 0x100 if x & 0x80 else x
+
+
+def s16(x):
+    x &= 0xFFFF
+    return x - 0x10000 if x & 0x8000 else x
+
+
+def s32(x):
+    x &= 0xFFFFFFFF
+    return x - 0x100000000 if x & 0x80000000 else x
+
+
+def median(a, b, c):
+    if a > b:
+        a, b = b, a
+    if b > c:
+        b = c
+    return a if a > b else b
+
+
+class ClockPll:
+    def __init__(self):
+        self.t = 0  # Absolute time in counts, TCNT1 is its low 16 bits
+        self.armed = False
+        self.ocr = 0
+        self.last_stamp = 0
+        self.intervals = [0, 0, 0]
+        self.interval_count = 0
+        self.period = 0
+        self.base = 0
+        self.next = 0
+        self.when = 0
+        self.sub = 0
+        self.received = 0
+        self.emitted = 0
+        self.phase_error = 0
+        self.phase_error_max = 0
+        self.subticks = []  # Times the 96ppqn gate fired
+        self.errors = []    # phase_error after each received clock
+        self.restart()
+
+    def tcnt(self):
+        return u16(self.t)
+
+    def restart(self):
+        self.received = 0
+        self.emitted = 0
+        self.sub = 0
+        self.stalled = 1
+        self.fresh = 1
+        self.phase_error_max = 0
+        self.armed = False
+
+    def arm(self, when):
+        self.when = u32(when)
+        self.ocr = u16(self.when >> 8)
+        self.armed = True
+
+    def due(self):
+        return s16(u16(self.when >> 8) - self.tcnt()) <= 0
+
+    def subtick(self):
+        sub = self.sub
+        if sub == 0:
+            if s8(self.emitted - self.received) > 0:
+                self.stalled = 1
+                self.armed = False
+                return
+            self.base = self.when
+            self.next = u32(self.base + self.period)
+            self.emitted = (self.emitted + 1) & 0xFF
+
+        self.subticks.append(self.t)
+
+        if self.interval_count < 3:
+            self.stalled = 1
+            self.armed = False
+            return
+
+        sub += 1
+        if sub == SUBTICKS:
+            sub = 0
+            self.arm(self.next)
+        else:
+            self.arm(self.base + (self.period >> 2) * sub)
+        self.sub = sub
+
+        if self.due():
+            self.armed = False
+            self.subtick()
+
+    def track(self, stamp):
+        now = u32(stamp << 8)
+
+        if not self.fresh:
+            interval = u16(stamp - self.last_stamp)
+            self.intervals = [interval] + self.intervals[:2]
+            if self.interval_count < 3:
+                self.interval_count += 1
+            m = median(*self.intervals) << 8
+            p = self.period
+            if self.interval_count < 3 or m > p + (p >> 2) or m < p - (p >> 2):
+                self.period = m
+            else:
+                self.period = u32(p + (s32(m - p) >> FREQUENCY_SHIFT))
+        self.last_stamp = stamp
+        self.fresh = 0
+        self.received = (self.received + 1) & 0xFF
+
+        lead = s8(self.emitted - self.received)
+        if lead == 0 and self.interval_count >= 3:
+            error = s16(stamp - u16(self.base >> 8))
+            self.phase_error = error
+            self.next = u32(self.base + self.period + (error << (8 - PHASE_SHIFT)))
+            if self.sub == 0:
+                self.stalled = 0
+                self.arm(self.next)
+        elif lead == -1 and not self.stalled and self.sub == 0:
+            error = s16(stamp - u16(self.when >> 8))
+            self.phase_error = error
+            self.arm(self.when + (error << (8 - PHASE_SHIFT)))
+        else:
+            self.phase_error = 0
+            self.emitted = (self.received - 1) & 0xFF
+            self.sub = 0
+            self.stalled = 0
+            self.when = now
+            self.armed = False
+            self.subtick()
+            return
+
+        self.phase_error_max = max(self.phase_error_max, abs(self.phase_error))
+        if self.due() and self.armed:
+            self.armed = False
+            self.subtick()
+
+    def next_compare(self):
+        # First count after now at which TCNT1 matches OCR1B
+        return self.t + (u16(self.ocr - self.tcnt() - 1) + 1)
+
+    def run_until(self, t):
+        while self.armed and self.next_compare() < t:
+            self.t = self.next_compare()
+            self.armed = False  # clock_subtick() re-arms as needed
+            self.subtick()
+        self.t = t
+
+    def clock(self, t):
+        self.run_until(t)
+        self.track(self.tcnt())
+        self.errors.append(self.phase_error)
+
+
+def clock_counts(bpm):
+    return 60e6 / (bpm * 24) / COUNT_US
+
+
+def play(times):
+    pll = ClockPll()
+    for t in times:
+        pll.clock(t)
+    pll.run_until(times[-1] + 1)
+    return pll
+
+
+def jitter_test():
+    rng = random.Random(1)
+    period = clock_counts(120)
+    jitter = JITTER_MS * 1000 / COUNT_US
+    times = [1000 + round(i * period + rng.uniform(-jitter, jitter)) for i in range(CLOCKS)]
+    pll = play(times)
+
+    def spread(steps, ideal):
+        return max(abs(s - ideal) for s in steps)
+
+    settled = [t for t in pll.subticks if t > times[24]]
+    steps = [b - a for a, b in zip(settled, settled[1:])]
+    received = [b - a for a, b in zip(times[24:], times[25:])]
+    print(f"jitter: 120 BPM, +-{JITTER_MS} ms ({jitter:.0f} counts) on each clock")
+    print(f"  received clock interval  {period:7.1f} counts, worst deviation {spread(received, period):5.1f}")
+    print(f"  96ppqn step              {period / 4:7.1f} counts, worst deviation {spread(steps, period / 4):5.1f}")
+    print(f"  phaseErrorMax            {pll.phase_error_max} counts")
+
+
+def jump_test():
+    before = clock_counts(120)
+    after = before / 1.1
+    times = [1000 + round(i * before) for i in range(CLOCKS // 2)]
+    times += [times[-1] + round((i + 1) * after) for i in range(CLOCKS // 2)]
+    pll = play(times)
+
+    errors = pll.errors[CLOCKS // 2:]
+    settle = len(errors)
+    while settle and abs(errors[settle - 1]) <= SETTLED_COUNTS:
+        settle -= 1
+    print(f"jump: 120 BPM then 10% faster at clock {CLOCKS // 2}")
+    print(f"  largest phase error      {max(abs(e) for e in errors)} counts")
+    print(f"  within +-{SETTLED_COUNTS} counts from clock {settle + 1} after the jump on")
+
+
+def main():
+    jitter_test()
+    jump_test()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+# Jump-ahead tables for the random step sequencer LFSR in Community/thorinf/csrc/random.c.
+# One LFSR step is linear over GF(2), so it is a 16x16 bit matrix A and stepping n times
+# is A^n. The table holds A^(2^k) for every bit k of a 16 bit step count, each matrix
+# as 16 columns where column j is the state reached from a state with only bit j set.
+
+BITS = 16
+TAPS = (0, 2, 3, 5)
+
+
+def update_lfsr(lfsr):
+    bit = 0
+    for tap in TAPS:
+        bit ^= (lfsr >> tap) & 1
+    return (lfsr >> 1) | (bit << 15)
+
+
+def apply(columns, state):
+    result = 0
+    for j in range(BITS):
+        if (state >> j) & 1:
+            result ^= columns[j]
+    return result
+
+
+def square(columns):
+    return [apply(columns, column) for column in columns]
+
+
+def jump(lfsr, steps, table):
+    for k, columns in enumerate(table):
+        if (steps >> k) & 1:
+            lfsr = apply(columns, lfsr)
+    return lfsr
+
+
+def to_header(table):
+    print(f"\nconst uint16_t lfsr_jump_table[LFSR_JUMP_POWERS][{BITS}] PROGMEM = {{")
+    for k, columns in enumerate(table):
+        words = ", ".join(f"0x{column:04X}" for column in columns)
+        print(f"    {{{words}}}" + ("," if k < len(table) - 1 else "") + f"  // A^{1 << k}")
+    print("};\n")
+
+
+def main():
+    table = [[update_lfsr(1 << j) for j in range(BITS)]]
+    for _ in range(BITS - 1):
+        table.append(square(table[-1]))
+
+    # Check against stepping one at a time
+    for seed in (0x0010, 0x1234, 0xFFFF):
+        lfsr = seed
+        for steps in range(1, 3000):
+            lfsr = update_lfsr(lfsr)
+            assert jump(seed, steps, table) == lfsr, (seed, steps)
+    print("Jump table matches single steps")
+
+    to_header(table)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,72 @@
+# Host check of the random step sequencer generators in Community/thorinf/csrc/random.c,
+# on the 12 bits the DAC keeps from each value.
+#   old: updateLfsr(), one shift per step
+#   new: stepLfsr(), sixteen shifts per step
+# Statistical quality only, the AVR cost of each is a hand estimate kept in random.h.
+
+import math
+
+SAMPLES = 65535
+BINS = 64
+
+
+def update_lfsr(lfsr):
+    bit = (lfsr ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5)) & 1
+    return (lfsr >> 1) | (bit << 15)
+
+
+def step_lfsr(lfsr):
+    for _ in range(2):
+        lfsr = (lfsr >> 8) | (((lfsr ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5)) << 8) & 0xFF00)
+    return lfsr
+
+
+def generate(step, seed=0x0010):
+    values = []
+    lfsr = seed
+    for _ in range(SAMPLES):
+        lfsr = step(lfsr)
+        values.append(lfsr >> 4)
+    return values
+
+
+def serial_correlation(values, lag=1):
+    n = len(values) - lag
+    mean = sum(values) / len(values)
+    var = sum((v - mean) ** 2 for v in values) / len(values)
+    cov = sum((values[i] - mean) * (values[i + lag] - mean) for i in range(n)) / n
+    return cov / var
+
+
+def chi_square(values):
+    counts = [0] * BINS
+    for v in values:
+        counts[v * BINS >> 12] += 1
+    expected = len(values) / BINS
+    return sum((c - expected) ** 2 / expected for c in counts)
+
+
+def pair_chi_square(values):
+    # Consecutive values as points on an 8x8 grid, catches steps that follow each other
+    cells = 8
+    counts = [0] * (cells * cells)
+    for a, b in zip(values[::2], values[1::2]):
+        counts[(a * cells >> 12) * cells + (b * cells >> 12)] += 1
+    expected = (len(values) // 2) / len(counts)
+    return sum((c - expected) ** 2 / expected for c in counts)
+
+
+def main():
+    for name, step in (("old", update_lfsr), ("new", step_lfsr)):
+        values = generate(step)
+        print(f"{name}:")
+        print(f"  lag-1 correlation  {serial_correlation(values):+.4f}")
+        print(f"  lag-2 correlation  {serial_correlation(values, 2):+.4f}")
+        print(f"  chi-square, {BINS} bins  {chi_square(values):8.1f}  (df {BINS - 1})")
+        print(f"  pair chi-square    {pair_chi_square(values):8.1f}  (df 63)")
+        print(f"  mean |step|        {sum(abs(a - b) for a, b in zip(values, values[1:])) / (len(values) - 1):.0f}"
+              f"  (uniform {4096 / 3:.0f})")
+
+
+if __name__ == "__main__":
+    main()